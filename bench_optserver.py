@@ -0,0 +1,63 @@
+# Compares the per-request latency of spawning `opt` with the optserver
+# fork-server. Usage:
+#   python3 bench_optserver.py <llvm bin> <tool bin> <input.ll> <passes> [runs]
+import os
+import sys
+import subprocess
+import tempfile
+import time
+
+llvm_opt = os.path.join(sys.argv[1], "opt")
+optserver_bin = os.path.join(sys.argv[2], "optserver")
+input_file = sys.argv[3]
+pass_name = sys.argv[4]
+runs = int(sys.argv[5]) if len(sys.argv) > 5 else 100
+
+work_dir = tempfile.mkdtemp()
+empty = os.path.join(work_dir, "empty.ll")
+with open(empty, "w") as f:
+    f.write("")
+out = os.path.join(work_dir, "out.ll")
+
+
+def bench_opt(src):
+    start = time.time()
+    for _ in range(runs):
+        subprocess.check_call(
+            [llvm_opt, "-S", "-o", out, src, "-passes=" + pass_name],
+            stderr=subprocess.DEVNULL,
+        )
+    return (time.time() - start) / runs
+
+
+def bench_optserver(src):
+    server = subprocess.Popen(
+        [optserver_bin, "--passes=" + pass_name],
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL,
+        text=True,
+    )
+    # Wait until the server is up, so that its own startup is not counted.
+    server.stdin.write(f"{empty} {out}\n")
+    server.stdin.flush()
+    server.stdout.readline()
+    start = time.time()
+    for _ in range(runs):
+        server.stdin.write(f"{src} {out}\n")
+        server.stdin.flush()
+        assert server.stdout.readline().strip() == "ok"
+    elapsed = (time.time() - start) / runs
+    server.stdin.close()
+    server.wait()
+    return elapsed
+
+
+print(f"Runs: {runs}")
+print("{:<10} {:>12} {:>16}".format("", "opt (ms)", "optserver (ms)"))
+for name, src in [("startup", empty), ("input", input_file)]:
+    print(
+        "{:<10} {:>12.2f} {:>16.2f}".format(
+            name, bench_opt(src) * 1000, bench_optserver(src) * 1000
+        )
+    )
@@ -10,7 +10,6 @@ cmake ../llvm-project/llvm -DCMAKE_BUILD_TYPE=Release -DBUILD_SHARED_LIBS=ON -G
     -DCMAKE_C_COMPILER_LAUNCHER=ccache -DCMAKE_CXX_COMPILER_LAUNCHER=ccache \
     -DLLVM_ENABLE_RTTI=ON -DLLVM_ENABLE_EH=ON -DLLVM_ENABLE_ZSTD=OFF
 cmake --build . -j 32 -t opt
-cmake --build . -j 32 -t llvm-extract
 
 cd ..
 mkdir -p alive2-build
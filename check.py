@@ -1,5 +1,300 @@
+import contextlib
+import functools
+import json
 import os
+import re
+import select
 import subprocess
+import time
+
+# Resident servers of the current worker process, keyed by tool name.
+servers = dict()
+
+# SMT timeouts (ms) of alive2. Functions are first verified with SMT_TIMEOUT;
+# those that time out are retried with ten times the timeout until
+# SMT_TIMEOUT_MAX.
+SMT_TIMEOUT = int(os.environ.get("SMT_TIMEOUT", 100))
+SMT_TIMEOUT_MAX = int(os.environ.get("SMT_TIMEOUT_MAX", 10000))
+
+# Wall-clock seconds verify gives a function in its first attempt, and at most
+# in a retry.
+VERIFY_TIMEOUT = 10
+VERIFY_MAX_TIMEOUT = 120
+# The longest a worker waits for the verdicts of one mutant.
+VERIFY_REQUEST_TIMEOUT = int(os.environ.get("VERIFY_REQUEST_TIMEOUT", 600))
+# Mutants of a batch with more functions than this are made of a sample of
+# MUTATE_SAMPLE of them, so that mutate only reads the functions it mutates.
+MUTATE_SAMPLE = int(os.environ.get("MUTATE_SAMPLE", 128))
+
+# Set by fuzz.py in its workers. Once it is set, the running job gives up at
+# the next point where it waits for a tool.
+cancel_event = None
+# The end of the campaign (time.time()), set by fuzz.py in its workers.
+campaign_deadline = None
+
+
+class Cancelled(Exception):
+    pass
+
+
+def set_cancel_event(event):
+    global cancel_event
+    cancel_event = event
+
+
+def set_campaign_deadline(deadline):
+    global campaign_deadline
+    campaign_deadline = deadline
+
+
+def check_cancelled():
+    if cancel_event is not None and cancel_event.is_set():
+        raise Cancelled()
+
+
+class JobStats:
+    """Latency and outcome of each stage of a job, aggregated by fuzz.py."""
+
+    def __init__(self):
+        # (stage, seconds, outcome)
+        self.stages = []
+        self.mutants = 0
+        # Function mutants rejected as duplicates, and made in all.
+        self.duplicates = 0
+        self.function_mutants = 0
+
+    @contextlib.contextmanager
+    def stage(self, name):
+        """Times the body as stage `name`. Its outcome is "ok" unless the body
+        sets record["outcome"] or raises."""
+        record = {"outcome": "ok"}
+        start = time.monotonic()
+        try:
+            yield record
+        except subprocess.TimeoutExpired:
+            record["outcome"] = "timeout"
+            raise
+        except Cancelled:
+            record["outcome"] = "cancelled"
+            raise
+        except Exception:
+            record["outcome"] = "error"
+            raise
+        finally:
+            self.stages.append((name, time.monotonic() - start, record["outcome"]))
+
+
+class Server:
+    """A tool that answers one request per line on stdin with one line."""
+
+    def __init__(self, cmd):
+        self.cmd = cmd
+        self.proc = subprocess.Popen(
+            cmd,
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+            text=True,
+        )
+
+    def alive(self):
+        return self.proc.poll() is None
+
+    def close(self):
+        if self.alive():
+            self.proc.stdin.close()
+            self.proc.wait()
+
+    def request(self, line, timeout=None):
+        self.proc.stdin.write(line + "\n")
+        self.proc.stdin.flush()
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            wait = 1.0
+            if deadline is not None:
+                wait = max(0.0, min(wait, deadline - time.monotonic()))
+            ready, _, _ = select.select([self.proc.stdout], [], [], wait)
+            if ready:
+                break
+            # A server that is abandoned in the middle of a request cannot be
+            # reused; it is restarted by the next get_server.
+            if deadline is not None and time.monotonic() >= deadline:
+                self.proc.kill()
+                raise subprocess.TimeoutExpired(self.cmd, timeout)
+            if cancel_event is not None and cancel_event.is_set():
+                self.proc.kill()
+                raise Cancelled()
+        reply = self.proc.stdout.readline().strip()
+        if not reply:
+            raise RuntimeError(f"{self.cmd[0]} exited")
+        return reply
+
+
+def get_server(name, cmd):
+    server = servers.get(name)
+    if server is None or server.cmd != cmd or not server.alive():
+        if server is not None:
+            server.close()
+        server = servers[name] = Server(cmd)
+    return server
+
+
+def mutate(mutate_bin, seeds, out, recipe, rng_seed=None, journal=None):
+    """Writes a mutant of `seeds` to `out`. Returns how many of the function
+    mutants made for it the server rejected as duplicates of earlier ones, and
+    how many it made in all."""
+    # With --dedup, a mutant depends on the ones the server produced before,
+    # so rng_seed alone does not reproduce it; its journal does.
+    cmd = [mutate_bin, "--serve", "--emit-bc", "--dedup", seeds]
+    sample = sample_size(count_functions(seeds))
+    if sample:
+        cmd.append(f"--sample={sample}")
+    server = get_server("mutate", cmd)
+    request = f"recipe={recipe} out={out}"
+    if rng_seed is not None:
+        request += f" rng-seed={rng_seed}"
+    if journal is not None:
+        request += f" journal={journal}"
+    reply = server.request(request)
+    status, _, duplicates = reply.partition(" duplicates=")
+    if status != "ok":
+        raise RuntimeError(f"mutate: {reply}")
+    rejected, _, made = duplicates.partition("/")
+    return int(rejected or 0), int(made or 0)
+
+
+def optimize(optserver_bin, pass_name, src, tgt):
+    server = get_server("opt", [optserver_bin, "--emit-bc", "--passes=" + pass_name])
+    return server.request(f"{src} {tgt}")
+
+
+def run_tool(cmd, timeout):
+    """Like subprocess.check_output, but also gives up once the job is
+    cancelled."""
+    with subprocess.Popen(
+        cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL
+    ) as proc:
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                out, _ = proc.communicate(timeout=1)
+                break
+            except subprocess.TimeoutExpired:
+                if time.monotonic() >= deadline:
+                    proc.kill()
+                    raise
+                if cancel_event is not None and cancel_event.is_set():
+                    proc.kill()
+                    raise Cancelled()
+    if proc.returncode != 0:
+        raise subprocess.CalledProcessError(proc.returncode, cmd, out)
+    return out
+
+
+def text_name(path):
+    return path.removesuffix(".bc") + ".ll"
+
+
+def disassemble(llvm_opt, path):
+    # Intermediate modules are bitcode. Only the ones that are kept for the
+    # issue report are turned into textual IR.
+    if os.path.exists(path):
+        if subprocess.call([llvm_opt, "-S", "-o", text_name(path), path]) == 0:
+            os.remove(path)
+
+
+@functools.cache
+def count_functions(seeds):
+    """Returns the number of functions in a batch written by `merge --index`,
+    or None if it has no index."""
+    try:
+        with open(seeds + ".index.json") as f:
+            return len(json.load(f)["functions"])
+    except (OSError, ValueError, KeyError):
+        return None
+
+
+def sample_size(functions):
+    """Returns the --sample of mutate for a batch of `functions` functions, or
+    None to mutate all of them."""
+    if functions is not None and functions > MUTATE_SAMPLE:
+        return MUTATE_SAMPLE
+    return None
+
+
+def verify_timeout(functions):
+    """Seconds to wait for verify: every function may use up its largest
+    budget, within VERIFY_REQUEST_TIMEOUT and what is left of the campaign."""
+    timeout = VERIFY_REQUEST_TIMEOUT
+    if functions:
+        timeout = min(timeout, functions * VERIFY_MAX_TIMEOUT)
+    if campaign_deadline is not None:
+        timeout = min(timeout, campaign_deadline - time.time())
+    return max(timeout, 1)
+
+
+def verify(
+    verify_bin,
+    alive2_tv,
+    src,
+    tgt,
+    stop_on_incorrect=False,
+    budget_history=None,
+    functions=None,
+):
+    """Verifies tgt against src with alive2. functions is the number of
+    functions in src, if known, which bounds how long verify may take.
+
+    Returns {"verdict": ..., "functions": [{"verdict": ..., "identical": ...}]}
+    as printed by `verify`, where a verdict is correct, incorrect, crash,
+    timeout, unsupported or skipped. Falls back to parsing the output of
+    alive-tv when verify was not built.
+    """
+    if os.path.exists(verify_bin):
+        # Each function first gets a 10s budget, which grows with the SMT
+        # timeout of its retries up to 120s. Functions that opt left unchanged
+        # are not verified at all.
+        cmd = [
+            verify_bin,
+            "--serve",
+            f"--smt-to={SMT_TIMEOUT}",
+            f"--smt-to-max={SMT_TIMEOUT_MAX}",
+            "--disable-undef-input",
+            f"--timeout={VERIFY_TIMEOUT}",
+            f"--max-timeout={VERIFY_MAX_TIMEOUT}",
+        ]
+        if stop_on_incorrect:
+            cmd.append("--stop-on-incorrect")
+        # The SMT timeouts the seed functions needed so far, so that slow ones
+        # skip the attempts that are bound to time out.
+        if budget_history:
+            cmd.append("--budget-history=" + budget_history)
+        # Verdicts are kept across campaigns in VERDICT_CACHE, and reused as
+        # long as neither LLVM nor alive2 changes.
+        cache = os.environ.get("VERDICT_CACHE")
+        if cache:
+            tag = "{}-{}".format(
+                os.environ.get("LLVM_REVISION", ""),
+                os.environ.get("ALIVE2_REVISION", ""),
+            )
+            cmd += ["--cache=" + cache, "--cache-tag=" + tag]
+        server = get_server("verify-stop" if stop_on_incorrect else "verify", cmd)
+        reply = server.request(f"{src} {tgt}", timeout=verify_timeout(functions))
+        if reply.startswith("error "):
+            raise RuntimeError(f"verify: {reply}")
+        return json.loads(reply)
+
+    out = subprocess.check_output(
+        [alive2_tv, f"--smt-to={SMT_TIMEOUT}", "--disable-undef-input", src, tgt],
+        timeout=60,
+    ).decode()
+    correct = out.count("Transformation seems to be correct!")
+    identical = out.count("(syntactically equal)")
+    incorrect = int(re.search(r"(\d+) incorrect transformations", out).group(1))
+    functions = [
+        {"verdict": "correct", "identical": i < identical} for i in range(correct)
+    ] + [{"verdict": "incorrect", "identical": False}] * incorrect
+    return {"verdict": "incorrect" if incorrect else "correct", "functions": functions}
 
 
 def check_once_impl(
@@ -13,61 +308,115 @@ def check_once_impl(
     alive2_tv,
     pass_name,
     compare,
+    rng_seed=None,
+    stats=None,
 ):
+    if stats is None:
+        stats = JobStats()
+    # Mutant `id` uses the seed rng_seed + id, but since the server rejects
+    # duplicates of its earlier mutants, only its journal reproduces it.
+    mutant_seed = None if rng_seed is None else rng_seed + id
+    functions = count_functions(seeds)
+    functions = sample_size(functions) or functions
+    timed_out = False
     try:
         filename = f"{recipe}-{id}"
-        src = os.path.join(work_dir, f"{recipe}-{id}.src.ll")
-        tgt = os.path.join(work_dir, f"{recipe}-{id}.tgt.ll")
-        tgt2 = os.path.join(work_dir, f"{recipe}-{id}.tgt2.ll")
-        subprocess.check_call([mutate_bin, seeds, src, recipe])
-        try:
-            subprocess.check_call(
-                [llvm_opt, "-S", "-o", tgt, src, "-passes=" + pass_name],
-                timeout=60,
-                stderr=subprocess.DEVNULL,
+        src = os.path.join(work_dir, f"{recipe}-{id}.src.bc")
+        tgt = os.path.join(work_dir, f"{recipe}-{id}.tgt.bc")
+        tgt2 = os.path.join(work_dir, f"{recipe}-{id}.tgt2.bc")
+        # The edits that turn the seeds into src, replayable with
+        # `mutate <seeds> <out> --replay=<journal>`.
+        journal = os.path.join(work_dir, f"{recipe}-{id}.journal.json")
+
+        def interesting(reason):
+            for file in [src, tgt, tgt2]:
+                disassemble(llvm_opt, file)
+            return filename, True, reason
+
+        with stats.stage("mutate"):
+            duplicates, made = mutate(
+                mutate_bin, seeds, src, recipe, mutant_seed, journal
             )
-        except subprocess.TimeoutExpired:
-            return filename, True, "timeout"
-        except Exception:
-            return filename, True, "crash"
+        stats.duplicates += duplicates
+        stats.function_mutants += made
+        stats.mutants += 1
+        check_cancelled()
+        # The opt stage goes through the optserver fork-server, which applies
+        # the same 60s timeout.
+        optserver_bin = os.path.join(os.path.dirname(mutate_bin), "optserver")
+        verify_bin = os.path.join(os.path.dirname(mutate_bin), "verify")
+        with stats.stage("opt") as stage:
+            res = optimize(optserver_bin, pass_name, src, tgt)
+            stage["outcome"] = res.split(" ")[0]
+        if res == "timeout":
+            return interesting("timeout")
+        if res != "ok":
+            return interesting("crash")
+        check_cancelled()
 
+        budget_history = os.path.join(work_dir, "smt-budgets.txt")
         if recipe == "correctness":
             try:
-                out = subprocess.check_output(
-                    [alive2_tv, "--smt-to=100", "--disable-undef-input", src, tgt],
-                    timeout=60,
-                ).decode()
-                if "0 incorrect transformations" not in out:
-                    return filename, True, ""
+                with stats.stage("alive2") as stage:
+                    res = verify(
+                        verify_bin,
+                        alive2_tv,
+                        src,
+                        tgt,
+                        stop_on_incorrect=True,
+                        budget_history=budget_history,
+                        functions=functions,
+                    )
+                    stage["outcome"] = res["verdict"]
+                if res["verdict"] == "incorrect":
+                    return interesting("")
+                if res["verdict"] == "crash":
+                    return interesting("alive2 crash")
+                if res["verdict"] == "timeout":
+                    # Not a bug, but not a proof either; counted by the caller.
+                    timed_out = True
             except subprocess.TimeoutExpired:
-                pass
+                timed_out = True
+            except Cancelled:
+                raise
             except Exception:
-                return filename, True, "alive2 crash"
+                return interesting("alive2 crash")
         elif recipe == "commutative" or recipe == "canonical-form":
-            funcname = compare(seeds_ref, tgt, None)
+            with stats.stage("cost"):
+                funcname = compare(seeds_ref, tgt, None)
             if funcname:
-                return (
-                    filename,
-                    True,
-                    src + ":" + funcname + " is not optimized as well.",
+                return interesting(
+                    text_name(src) + ":" + funcname + " is not optimized as well."
                 )
         elif recipe == "multi-use":
-            funcname = compare(src, tgt, seeds_ref)
+            with stats.stage("cost"):
+                funcname = compare(src, tgt, seeds_ref)
             if funcname:
-                return (
-                    filename,
-                    True,
-                    tgt + ":" + funcname + " has more instructions than before.",
+                return interesting(
+                    text_name(tgt)
+                    + ":"
+                    + funcname
+                    + " has more instructions than before."
                 )
         elif recipe == "flag-preserving":
-            subprocess.check_call([mutate_bin, tgt, tgt2, recipe])
-            out = subprocess.check_output(
-                [alive2_tv, "--smt-to=100", "--disable-undef-input", src, tgt2],
-                timeout=60,
-            ).decode()
-            assert "(syntactically equal)" not in out
-            if "Transformation seems to be correct" in out:
-                return filename, True, ""
+            cmd = [mutate_bin, tgt, tgt2, recipe, "--emit-bc"]
+            if mutant_seed is not None:
+                cmd.append(f"--rng-seed={mutant_seed}")
+            with stats.stage("mutate"):
+                subprocess.check_call(cmd)
+            with stats.stage("alive2") as stage:
+                res = verify(
+                    verify_bin,
+                    alive2_tv,
+                    src,
+                    tgt2,
+                    budget_history=budget_history,
+                    functions=functions,
+                )
+                stage["outcome"] = res["verdict"]
+            assert not any(func["identical"] for func in res["functions"])
+            if any(func["verdict"] == "correct" for func in res["functions"]):
+                return interesting("")
         else:
             return filename, False, ""
     except Exception:
@@ -79,4 +428,48 @@ def check_once_impl(
         os.remove(tgt)
     if os.path.exists(tgt2):
         os.remove(tgt2)
+    if os.path.exists(journal):
+        os.remove(journal)
+    return filename, False, "alive2 timeout" if timed_out else ""
+
+
+def check_batch_impl(
+    id, work_dir, recipe, seeds, driver_bin, pass_name, batch, rng_seed, stats=None
+):
+    if stats is None:
+        stats = JobStats()
+    # The driver mutates, optimizes and compares costs in process, and only
+    # writes the first interesting mutant of the batch.
+    first_id = id * batch
+    filename = f"{recipe}-{first_id}"
+    try:
+        # The driver has no separate stages to time.
+        with stats.stage("driver") as stage:
+            out = run_tool(
+                [
+                    driver_bin,
+                    seeds,
+                    recipe,
+                    work_dir,
+                    "--passes=" + pass_name,
+                    f"--count={batch}",
+                    f"--first-id={first_id}",
+                    f"--rng-seed={rng_seed}",
+                ],
+                # Each mutant gets 60s in the driver, plus the seed itself.
+                timeout=60 * (batch + 1),
+            ).decode()
+            lines = out.splitlines()
+            if lines and lines[0].endswith(("\tcrash", "\ttimeout")):
+                stage["outcome"] = lines[0].rsplit("\t", 1)[1]
+        for line in lines:
+            filename, reason = line.split("\t", 1)
+            # The batch ends at the first interesting mutant.
+            stats.mutants += int(filename.rsplit("-", 1)[1]) - first_id + 1
+            return filename, True, reason
+        stats.mutants += batch
+    except subprocess.TimeoutExpired:
+        return filename, False, "driver timeout"
+    except Exception:
+        pass
     return filename, False, ""
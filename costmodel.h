@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+
+#include <cstdint>
+
+namespace llvm {
+class Function;
+} // namespace llvm
+
+// A rough estimation of the cost of F. It is used to check whether a mutant
+// is optimized as well as the original seed.
+uint32_t getFunctionCost(const llvm::Function &F);
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "costmodel.h"
+#include "io.h"
+#include "mutator.h"
+#include "process.h"
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/CrashRecoveryContext.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <cstdlib>
+#include <optional>
+#include <string>
+
+using namespace llvm;
+
+static cl::opt<std::string> SeedFile(cl::Positional, cl::desc("<seed>"),
+                                     cl::Required, cl::value_desc("seed file"));
+static cl::opt<std::string> Recipe(cl::Positional, cl::desc("<recipe>"),
+                                   cl::Required, cl::value_desc("recipe"));
+static cl::opt<std::string> OutputDir(cl::Positional,
+                                      cl::desc("<output dir>"), cl::Required,
+                                      cl::value_desc("path to output dir"));
+static cl::opt<std::string>
+    Passes("passes", cl::desc("Pass pipeline to test, as in opt -passes=..."),
+           cl::Required);
+static cl::opt<uint32_t> Count("count",
+                               cl::desc("Number of mutants to generate"),
+                               cl::init(1));
+static cl::opt<uint32_t>
+    FirstId("first-id",
+            cl::desc("Index of the first mutant. Interesting mutants are "
+                     "written to <output dir>/<recipe>-<index>.{src,tgt}.ll"),
+            cl::init(0));
+static cl::opt<uint64_t>
+    RngSeed("rng-seed",
+            cl::desc("Base seed. Mutant N is mutated with this seed plus N, "
+                     "like 'mutate --rng-seed'. Random if not given"));
+
+static cl::opt<uint32_t>
+    Timeout("timeout",
+            cl::desc("Seconds after which the pipeline is killed on a mutant "
+                     "(0 = never)"),
+            cl::init(60));
+
+static cl::opt<bool>
+    Dedup("dedup",
+          cl::desc("Reject function mutants already produced in this batch and "
+                   "print the duplicate rate to stderr. Mutants then depend on "
+                   "the earlier ones of the batch, so --first-id no longer "
+                   "reproduces them alone"),
+          cl::init(false));
+
+using CostMap = StringMap<uint32_t>;
+
+static CostMap getCosts(const Module &M) {
+  CostMap Costs;
+  for (auto &F : M)
+    if (!F.empty())
+      Costs[F.getName()] = getFunctionCost(F);
+  return Costs;
+}
+
+// Runs the pass pipeline on M. Returns false if the pipeline crashes or leaves
+// broken IR behind, which opt reports as a crash too.
+static bool runPipeline(Module &M) {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB;
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (Error E = PB.parsePassPipeline(MPM, Passes))
+    report_fatal_error(std::move(E));
+
+  CrashRecoveryContext CRC;
+  if (!CRC.RunSafely([&] { MPM.run(M, MAM); }))
+    return false;
+  return !verifyModule(M, &errs());
+}
+
+// Returns the first function in After that is more expensive than in Before.
+// If Precond is given, regressions on functions that are already cheaper in
+// Before than in Precond are ignored.
+static std::optional<StringRef> findRegression(const CostMap &Before,
+                                               const Module &After,
+                                               const CostMap *Precond) {
+  for (auto &F : After) {
+    if (F.empty())
+      continue;
+    StringRef Name = F.getName();
+    auto It = Before.find(Name);
+    if (It == Before.end())
+      continue;
+    uint32_t BeforeCost = It->second;
+    if (BeforeCost < getFunctionCost(F)) {
+      if (Precond && BeforeCost < Precond->lookup(Name))
+        continue;
+      return Name;
+    }
+  }
+  return std::nullopt;
+}
+
+// Exit codes of the child that runs the pipeline on a mutant.
+enum { Reported = 3, WriteFailed = 4 };
+
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "driver\n");
+
+  MutateFuncTy mutateFunc = getRecipe(Recipe);
+  if (!mutateFunc) {
+    errs() << "Unknown recipe " << Recipe << "\n";
+    return EXIT_FAILURE;
+  }
+  bool IsMultiUse = Recipe == "multi-use";
+  if (!IsMultiUse && Recipe != "commutative" && Recipe != "canonical-form") {
+    errs() << "Recipe " << Recipe
+           << " needs alive2 and is not supported by the driver\n";
+    return EXIT_FAILURE;
+  }
+
+  LLVMContext Ctx;
+  SMDiagnostic Err;
+  auto Seed = parseIRFile(SeedFile, Err, Ctx);
+  if (!Seed) {
+    Err.print(argv[0], errs());
+    return EXIT_FAILURE;
+  }
+
+  CrashRecoveryContext::Enable();
+
+  auto Ref = CloneModule(*Seed);
+  if (!runPipeline(*Ref)) {
+    errs() << "The pass pipeline crashes on the seed\n";
+    return EXIT_FAILURE;
+  }
+  CostMap RefCosts = getCosts(*Ref);
+  Ref.reset();
+
+  uint64_t BaseSeed =
+      RngSeed.getNumOccurrences() ? RngSeed.getValue() : getRandomSeed();
+
+  MutantSet Seen;
+  auto PrintStats = make_scope_exit([&] {
+    if (Dedup)
+      errs() << "Duplicates: " << Recipe << '=' << Seen.Duplicates << '/'
+             << Seen.Mutants + Seen.Duplicates << '\n';
+  });
+
+  for (uint32_t Idx = FirstId; Idx != FirstId + Count; ++Idx) {
+    auto Src = CloneModule(*Seed);
+    MutationJournal Journal;
+    MutationOptions Opts;
+    Opts.Journal = &Journal;
+    if (Dedup)
+      Opts.Seen = &Seen;
+    mutateModule(*Src, mutateFunc, BaseSeed + Idx, Opts);
+
+    std::string Name = Recipe + "-" + std::to_string(Idx);
+    SmallString<128> SrcPath(OutputDir), TgtPath(OutputDir),
+        JournalPath(OutputDir);
+    sys::path::append(SrcPath, Name + ".src.ll");
+    sys::path::append(TgtPath, Name + ".tgt.ll");
+    sys::path::append(JournalPath, Name + ".journal.json");
+
+    // The pipeline runs in a child with the timeout opt runs under, so that a
+    // hang is reported like a crash instead of stalling the whole batch.
+    ChildResult Res = runInChild(
+        [&]() -> int {
+          auto Tgt = CloneModule(*Src);
+          if (!runPipeline(*Tgt))
+            return EXIT_FAILURE;
+
+          std::string Reason;
+          if (IsMultiUse) {
+            CostMap SrcCosts = getCosts(*Src);
+            if (auto Func = findRegression(SrcCosts, *Tgt, &RefCosts))
+              Reason = (Twine(TgtPath) + ":" + *Func +
+                        " has more instructions than before.")
+                           .str();
+          } else if (auto Func = findRegression(RefCosts, *Tgt, nullptr)) {
+            Reason = (Twine(SrcPath) + ":" + *Func +
+                      " is not optimized as well.")
+                         .str();
+          }
+          if (Reason.empty())
+            return EXIT_SUCCESS;
+
+          if (!writeModule(*Src, SrcPath, /*Bitcode=*/false) ||
+              !writeModule(*Tgt, TgtPath, /*Bitcode=*/false) ||
+              !writeJournal(Journal, JournalPath))
+            return WriteFailed;
+          outs() << Name << '\t' << Reason << '\n';
+          return Reported;
+        },
+        Timeout);
+
+    if (Res.succeeded())
+      continue;
+    if (Res.Kind == ChildResult::Exited && Res.Code == Reported)
+      return EXIT_SUCCESS;
+    if (Res.Kind == ChildResult::Exited && Res.Code == WriteFailed)
+      return EXIT_FAILURE;
+    // The child crashed, timed out or left broken IR; only the source is
+    // written out since the target is lost with it.
+    if (!writeModule(*Src, SrcPath, /*Bitcode=*/false) ||
+        !writeJournal(Journal, JournalPath))
+      return EXIT_FAILURE;
+    outs() << Name << '\t'
+           << (Res.Kind == ChildResult::TimedOut ? "timeout" : "crash") << '\n';
+    return EXIT_SUCCESS;
+  }
+
+  return EXIT_SUCCESS;
+}
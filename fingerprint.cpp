@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "fingerprint.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/Argument.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Type.h>
+#include <llvm/Support/xxhash.h>
+
+using namespace llvm;
+
+namespace {
+class FunctionHasher {
+  uint64_t Hash = 0;
+  DenseMap<const Value *, uint64_t> LocalIds;
+  SmallPtrSet<const MDNode *, 8> VisitedMD;
+  SmallPtrSet<const GlobalValue *, 8> VisitedGlobals;
+
+  void add(uint64_t V) {
+    // splitmix64 finalizer
+    uint64_t Z = (Hash ^ V) + 0x9e3779b97f4a7c15ULL;
+    Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+    Hash = Z ^ (Z >> 31);
+  }
+  void add(StringRef S) { add(xxh3_64bits(S)); }
+  void add(const APInt &V) {
+    add(V.getBitWidth());
+    for (unsigned I = 0, E = V.getNumWords(); I != E; ++I)
+      add(V.getRawData()[I]);
+  }
+
+  void addType(Type *Ty) {
+    add(Ty->getTypeID());
+    if (auto *IntTy = dyn_cast<IntegerType>(Ty))
+      add(IntTy->getBitWidth());
+    else if (auto *PtrTy = dyn_cast<PointerType>(Ty))
+      add(PtrTy->getAddressSpace());
+    else if (auto *VecTy = dyn_cast<VectorType>(Ty)) {
+      add(VecTy->getElementCount().getKnownMinValue());
+      addType(VecTy->getElementType());
+    } else if (auto *ArrTy = dyn_cast<ArrayType>(Ty)) {
+      add(ArrTy->getNumElements());
+      addType(ArrTy->getElementType());
+    } else {
+      // Structs and functions
+      add(Ty->getNumContainedTypes());
+      for (Type *Sub : Ty->subtypes())
+        addType(Sub);
+    }
+  }
+
+  void addAttributes(AttributeList Attrs, unsigned NumParams) {
+    add(Attrs.getFnAttrs().getAsString());
+    add(Attrs.getRetAttrs().getAsString());
+    for (unsigned I = 0; I != NumParams; ++I)
+      add(Attrs.getParamAttrs(I).getAsString());
+  }
+
+  void addMetadata(const Metadata *MD) {
+    if (auto *S = dyn_cast<MDString>(MD))
+      add(S->getString());
+    else if (auto *VAM = dyn_cast<ValueAsMetadata>(MD))
+      addValue(VAM->getValue());
+    else if (auto *N = dyn_cast<MDNode>(MD)) {
+      // Nodes may be self-referential (e.g. loop metadata).
+      if (!VisitedMD.insert(N).second)
+        return;
+      add(N->getNumOperands());
+      for (auto &Op : N->operands())
+        if (Op)
+          addMetadata(Op.get());
+    }
+  }
+
+  void addValue(const Value *V) {
+    add(V->getValueID());
+    addType(V->getType());
+    if (auto It = LocalIds.find(V); It != LocalIds.end()) {
+      add(It->second);
+      return;
+    }
+    if (auto *Arg = dyn_cast<Argument>(V)) {
+      add(Arg->getArgNo());
+      return;
+    }
+    if (auto *GV = dyn_cast<GlobalValue>(V)) {
+      add(GV->getName());
+      // Test files reuse names like @g for different globals, so what the
+      // function can see of a global is hashed with its name.
+      if (!VisitedGlobals.insert(GV).second)
+        return;
+      add(GV->getLinkage());
+      if (auto *Var = dyn_cast<GlobalVariable>(GV)) {
+        addType(Var->getValueType());
+        add(Var->isConstant());
+        add(Var->getAlign() ? Var->getAlign()->value() : 0);
+        add(Var->hasInitializer());
+        if (Var->hasInitializer())
+          addValue(Var->getInitializer());
+      } else if (auto *Callee = dyn_cast<Function>(GV)) {
+        addAttributes(Callee->getAttributes(), Callee->arg_size());
+      }
+      return;
+    }
+    if (auto *CI = dyn_cast<ConstantInt>(V)) {
+      add(CI->getValue());
+      return;
+    }
+    if (auto *CFP = dyn_cast<ConstantFP>(V)) {
+      add(CFP->getValueAPF().bitcastToAPInt());
+      return;
+    }
+    if (auto *CDS = dyn_cast<ConstantDataSequential>(V)) {
+      add(CDS->getRawDataValues());
+      return;
+    }
+    if (auto *C = dyn_cast<Constant>(V)) {
+      // Aggregates and constant expressions. Null, undef and poison values
+      // are identified by their value id and type.
+      add(C->getNumOperands());
+      for (auto &Op : C->operands())
+        addValue(Op.get());
+      return;
+    }
+    if (auto *MAV = dyn_cast<MetadataAsValue>(V))
+      addMetadata(MAV->getMetadata());
+  }
+
+  // Sync scope ids are numbered per context, so their names are hashed.
+  void addSyncScope(const Instruction &I, SyncScope::ID SSID) {
+    SmallVector<StringRef> Names;
+    I.getContext().getSyncScopeNames(Names);
+    add(Names[SSID]);
+  }
+
+  void addInstruction(const Instruction &I) {
+    add(I.getOpcode());
+    addType(I.getType());
+    add(I.getRawSubclassOptionalData());
+    if (auto *Cmp = dyn_cast<CmpInst>(&I))
+      add(Cmp->getPredicate());
+    if (auto *GEP = dyn_cast<GetElementPtrInst>(&I))
+      addType(GEP->getSourceElementType());
+    if (auto *Alloca = dyn_cast<AllocaInst>(&I)) {
+      addType(Alloca->getAllocatedType());
+      add(Alloca->getAlign().value());
+    }
+    if (auto *Load = dyn_cast<LoadInst>(&I)) {
+      add(Load->getAlign().value());
+      add(Load->isVolatile());
+      add(static_cast<uint64_t>(Load->getOrdering()));
+      addSyncScope(I, Load->getSyncScopeID());
+    }
+    if (auto *Store = dyn_cast<StoreInst>(&I)) {
+      add(Store->getAlign().value());
+      add(Store->isVolatile());
+      add(static_cast<uint64_t>(Store->getOrdering()));
+      addSyncScope(I, Store->getSyncScopeID());
+    }
+    if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+      add(RMW->getOperation());
+      add(RMW->getAlign().value());
+      add(RMW->isVolatile());
+      add(static_cast<uint64_t>(RMW->getOrdering()));
+      addSyncScope(I, RMW->getSyncScopeID());
+    }
+    if (auto *CmpXchg = dyn_cast<AtomicCmpXchgInst>(&I)) {
+      add(CmpXchg->getAlign().value());
+      add(CmpXchg->isVolatile());
+      add(CmpXchg->isWeak());
+      add(static_cast<uint64_t>(CmpXchg->getSuccessOrdering()));
+      add(static_cast<uint64_t>(CmpXchg->getFailureOrdering()));
+      addSyncScope(I, CmpXchg->getSyncScopeID());
+    }
+    if (auto *Fence = dyn_cast<FenceInst>(&I)) {
+      add(static_cast<uint64_t>(Fence->getOrdering()));
+      addSyncScope(I, Fence->getSyncScopeID());
+    }
+    if (auto *Call = dyn_cast<CallBase>(&I)) {
+      add(Call->getCallingConv());
+      addType(Call->getFunctionType());
+      addAttributes(Call->getAttributes(), Call->arg_size());
+    }
+    if (auto *Call = dyn_cast<CallInst>(&I))
+      add(Call->getTailCallKind());
+    // Masks and aggregate indices are not operands, and a mutation may change
+    // nothing else.
+    if (auto *Shuffle = dyn_cast<ShuffleVectorInst>(&I)) {
+      add(Shuffle->getShuffleMask().size());
+      for (int Elt : Shuffle->getShuffleMask())
+        add(static_cast<uint64_t>(Elt));
+    }
+    if (auto *Extract = dyn_cast<ExtractValueInst>(&I)) {
+      add(Extract->getNumIndices());
+      for (unsigned Idx : Extract->indices())
+        add(Idx);
+    }
+    if (auto *Insert = dyn_cast<InsertValueInst>(&I)) {
+      add(Insert->getNumIndices());
+      for (unsigned Idx : Insert->indices())
+        add(Idx);
+    }
+    if (auto *PHI = dyn_cast<PHINode>(&I))
+      for (auto *BB : PHI->blocks())
+        addValue(BB);
+
+    add(I.getNumOperands());
+    for (auto &Op : I.operands())
+      addValue(Op.get());
+
+    SmallVector<std::pair<unsigned, MDNode *>> MDs;
+    I.getAllMetadata(MDs);
+    for (auto &[Kind, MD] : MDs) {
+      add(Kind);
+      addMetadata(MD);
+    }
+  }
+
+public:
+  uint64_t hash(const Function &F) {
+    // Number blocks and instructions first, so that forward references (e.g.
+    // from phi nodes) can be hashed by position.
+    for (auto &BB : F) {
+      LocalIds[&BB] = LocalIds.size();
+      for (auto &I : BB)
+        LocalIds[&I] = LocalIds.size();
+    }
+
+    addType(F.getFunctionType());
+    add(F.getCallingConv());
+    addAttributes(F.getAttributes(), F.arg_size());
+    for (auto &BB : F) {
+      add(BB.size());
+      for (auto &I : BB)
+        addInstruction(I);
+    }
+    return Hash;
+  }
+};
+} // namespace
+
+uint64_t getFunctionHash(const Function &F) { return FunctionHasher().hash(F); }
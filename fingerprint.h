@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+
+#include <cstdint>
+
+namespace llvm {
+class Function;
+} // namespace llvm
+
+// Returns a hash of the body and signature of F. Unlike StructuralHash, it
+// covers everything a mutator may change (poison-generating and fast-math
+// flags, attributes, metadata, constant values, shuffle masks, aggregate
+// indices and the other state instructions keep outside their operands), as
+// well as the linkage and definition of the globals it references. It ignores
+// the names of F and of its local values, and does not depend on the
+// LLVMContext or the process, so it can be compared across modules and runs.
+uint64_t getFunctionHash(const llvm::Function &F);
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "fingerprint.h"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cstdlib>
+#include <optional>
+
+using namespace llvm;
+
+namespace {
+// Two definitions of @f, and whether getFunctionHash should tell them apart.
+struct HashCase {
+  const char *Name;
+  const char *A;
+  const char *B;
+  bool Differ;
+};
+
+const HashCase Cases[] = {
+    {"local names",
+     "define i32 @f(i32 %x) {\n"
+     "  %a = add i32 %x, 1\n"
+     "  ret i32 %a\n"
+     "}\n",
+     "define i32 @f(i32 %y) {\n"
+     "  %b = add i32 %y, 1\n"
+     "  ret i32 %b\n"
+     "}\n",
+     false},
+    {"shuffle mask",
+     "define <2 x i32> @f(<2 x i32> %a, <2 x i32> %b) {\n"
+     "  %s = shufflevector <2 x i32> %a, <2 x i32> %b, <2 x i32> <i32 0, "
+     "i32 1>\n"
+     "  ret <2 x i32> %s\n"
+     "}\n",
+     "define <2 x i32> @f(<2 x i32> %a, <2 x i32> %b) {\n"
+     "  %s = shufflevector <2 x i32> %a, <2 x i32> %b, <2 x i32> <i32 1, "
+     "i32 0>\n"
+     "  ret <2 x i32> %s\n"
+     "}\n",
+     true},
+    {"extractvalue index",
+     "define i32 @f({ i32, i32 } %a) {\n"
+     "  %e = extractvalue { i32, i32 } %a, 0\n"
+     "  ret i32 %e\n"
+     "}\n",
+     "define i32 @f({ i32, i32 } %a) {\n"
+     "  %e = extractvalue { i32, i32 } %a, 1\n"
+     "  ret i32 %e\n"
+     "}\n",
+     true},
+    {"insertvalue index",
+     "define { i32, i32 } @f({ i32, i32 } %a, i32 %x) {\n"
+     "  %i = insertvalue { i32, i32 } %a, i32 %x, 0\n"
+     "  ret { i32, i32 } %i\n"
+     "}\n",
+     "define { i32, i32 } @f({ i32, i32 } %a, i32 %x) {\n"
+     "  %i = insertvalue { i32, i32 } %a, i32 %x, 1\n"
+     "  ret { i32, i32 } %i\n"
+     "}\n",
+     true},
+    {"alloca type",
+     "define void @f() {\n"
+     "  %p = alloca i32, align 4\n"
+     "  ret void\n"
+     "}\n",
+     "define void @f() {\n"
+     "  %p = alloca float, align 4\n"
+     "  ret void\n"
+     "}\n",
+     true},
+    {"tail call kind",
+     "declare void @g()\n"
+     "define void @f() {\n"
+     "  call void @g()\n"
+     "  ret void\n"
+     "}\n",
+     "declare void @g()\n"
+     "define void @f() {\n"
+     "  tail call void @g()\n"
+     "  ret void\n"
+     "}\n",
+     true},
+};
+
+std::optional<uint64_t> hashF(const char *IR) {
+  LLVMContext Ctx;
+  SMDiagnostic Err;
+  auto M = parseIR(MemoryBufferRef(IR, "test"), Err, Ctx);
+  if (!M) {
+    Err.print("fingerprint-test", errs());
+    return std::nullopt;
+  }
+  return getFunctionHash(*M->getFunction("f"));
+}
+} // namespace
+
+// Checks that getFunctionHash ignores local names and tells apart functions
+// that differ only in state instructions keep outside their operands.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+
+  int Failed = 0;
+  for (auto &Case : Cases) {
+    auto A = hashF(Case.A);
+    auto B = hashF(Case.B);
+    if (!A || !B || (*A != *B) != Case.Differ) {
+      errs() << "FAIL: " << Case.Name << '\n';
+      ++Failed;
+    }
+  }
+  return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,24 +1,41 @@
+import collections
+import hashlib
+import json
+import math
 import os
 import sys
 import subprocess
 import shutil
 import re
-from multiprocessing import Pool
+import multiprocessing
+from concurrent.futures import FIRST_COMPLETED, ProcessPoolExecutor, wait
 import time
-from check import check_once_impl
+import random
+from check import (
+    JobStats,
+    check_once_impl,
+    check_batch_impl,
+    set_campaign_deadline,
+    set_cancel_event,
+)
 
 alive2_tv = sys.argv[1]
 llvm_bin = sys.argv[2]
 llvm_opt = os.path.join(llvm_bin, "opt")
-llvm_extract = os.path.join(llvm_bin, "llvm-extract")
 patched_llvm_src = sys.argv[3]
 tool_bin = sys.argv[4]
 mutate_bin = os.path.join(tool_bin, "mutate")
 merge_bin = os.path.join(tool_bin, "merge")
 cost_bin = os.path.join(tool_bin, "cost")
+driver_bin = os.path.join(tool_bin, "driver")
 patch_file = sys.argv[5]
 work_dir = "fuzz"
 fuzz_mode = os.environ["FUZZ_MODE"]
+# Mutant <recipe>-<n> is mutated with rng_seed + n, so it can be regenerated
+# from the seeds and this value instead of being kept on disk.
+rng_seed = int(os.environ.get("FUZZ_RNG_SEED", random.getrandbits(48)))
+# Per-stage latencies and outcomes of the campaign, as JSON.
+stats_file = os.environ.get("FUZZ_STATS", os.path.join(work_dir, "stats.json"))
 
 keywords = [
     ("test/Transforms/InstCombine", "instcombine<no-verify-fixpoint>"),
@@ -80,36 +97,37 @@ def collect_seeds():
 
 
 # Extract seeds
-os.makedirs(os.path.join(work_dir, "seeds"))
 seeds = collect_seeds()
 if len(seeds) == 0:
     print("No seeds found")
     exit(0)
 seeds_count = len(seeds)
 
-cnt = 0
-for file, func in seeds:
-    subprocess.run(
-        [
-            llvm_extract,
-            "-S",
-            "-func",
-            func,
-            "-o",
-            os.path.join(work_dir, "seeds", f"seed{cnt}.ll"),
-            os.path.join(patched_llvm_src, file),
-        ]
-    )
-    cnt += 1
+# merge parses each test file once and extracts the listed functions itself.
+manifest = os.path.join(work_dir, "seeds.txt")
+with open(manifest, "w") as f:
+    for file, func in sorted(seeds):
+        f.write("{}\t{}\n".format(os.path.join(patched_llvm_src, file), func))
 
 # Merge seeds into one file
-seeds = os.path.join(work_dir, "seeds.ll")
-seeds_ref = os.path.join(work_dir, "seeds_ref.ll")
-subprocess.check_call([merge_bin, os.path.join(work_dir, "seeds"), seeds])
-subprocess.check_call([llvm_opt, "-S", "-o", seeds_ref, seeds, "-passes=" + pass_name])
+seeds = os.path.join(work_dir, "seeds.bc")
+seeds_ref = os.path.join(work_dir, "seeds_ref.bc")
+# The index tells check.py how many functions a mutant has at most.
+merge_cmd = [merge_bin, "--manifest=" + manifest, seeds, "--emit-bc", "--index"]
+# Filtered seeds are kept across campaigns in SEED_CACHE, and reused as long as
+# LLVM does not change. merge is built from the patched tree, so the patch is
+# part of the tag: it may change how IR is parsed or upgraded.
+if os.environ.get("SEED_CACHE"):
+    with open(patch_file, "rb") as f:
+        patch_hash = hashlib.sha256(f.read()).hexdigest()
+    merge_cmd += [
+        "--cache=" + os.environ["SEED_CACHE"],
+        "--cache-tag={}-{}".format(os.environ.get("LLVM_REVISION", ""), patch_hash),
+    ]
+subprocess.check_call(merge_cmd + ["--print-timing"])
+subprocess.check_call([llvm_opt, "-o", seeds_ref, seeds, "-passes=" + pass_name])
 
 # Checks
-recipe = ""
 
 
 def parse_cost(output: str):
@@ -149,7 +167,25 @@ def compare(before, after, precond):
     return None
 
 
-def check_once(id):
+# Recipes that only need opt and the cost model run in process in the driver,
+# `driver_batch` mutants per job.
+driver_recipes = ["commutative", "multi-use", "canonical-form"]
+driver_batch = 16
+
+
+def check_once(recipe, id, stats=None):
+    if recipe in driver_recipes:
+        return check_batch_impl(
+            id,
+            work_dir,
+            recipe,
+            seeds,
+            driver_bin,
+            pass_name,
+            driver_batch,
+            rng_seed,
+            stats,
+        )
     return check_once_impl(
         id,
         work_dir,
@@ -161,58 +197,300 @@ def check_once(id):
         alive2_tv,
         pass_name,
         compare,
+        rng_seed,
+        stats,
     )
 
 
-def check(recipe_arg, time_budget):
-    global recipe
-    recipe = recipe_arg
+# Cancellation events of the recipes, inherited by the workers.
+cancel_events = dict()
+
+
+def init_worker(events, deadline):
+    global cancel_events
+    cancel_events = events
+    set_campaign_deadline(deadline)
 
+
+def run_job(recipe, id):
+    # Jobs check the event of their recipe while they wait for a tool, so
+    # that in-flight work stops soon after a finding or the deadline.
+    set_cancel_event(cancel_events[recipe])
+    stats = JobStats()
     start = time.time()
-    processes = os.cpu_count()
-    files_per_iter = 20 * processes
-    idx = 0
-    with Pool(processes) as pool:
-        while time.time() - start < time_budget:
-            final_res = False
-            reason_dict = dict()
-            for filename, res, reason in pool.imap_unordered(
-                check_once, range(idx, idx + files_per_iter)
-            ):
-                final_res |= res
-                if res:
-                    reason_dict[filename] = reason
-                    break
-            if final_res:
-                # only keep at most 1 file
-                cnt = 1
-                kept_files = []
-                for file in os.listdir(work_dir):
-                    if file.startswith(recipe):
-                        name = file.split(".")[0]
-                        if name in kept_files:
-                            continue
-                        if cnt > 0 and name in reason_dict:
-                            cnt -= 1
-                            kept_files.append(name)
-                            if reason_dict[name] != "":
-                                print(name, reason_dict[name])
-                        else:
-                            try:
-                                os.remove(os.path.join(work_dir, file))
-                            except Exception:
-                                pass
-                return True
-            idx += files_per_iter
-    return False
+    return check_once(recipe, id, stats), time.time() - start, stats
+
+
+# Workers are forked so that they see the seeds and the pass.
+mp_context = multiprocessing.get_context("fork")
+processes = os.cpu_count()
+
+
+class Histogram:
+    """Latencies in log-spaced buckets, ten per decade from 1ms, so that
+    percentiles are within 26% without keeping every sample."""
+
+    def __init__(self):
+        self.buckets = collections.Counter()
+        self.count = 0
+        self.total = 0.0
+        self.max = 0.0
+
+    @staticmethod
+    def bound(bucket):
+        return 1e-3 * 10 ** (bucket / 10)
+
+    def add(self, seconds):
+        bucket = max(0, math.ceil(10 * math.log10(max(seconds, 1e-3) / 1e-3)))
+        self.buckets[bucket] += 1
+        self.count += 1
+        self.total += seconds
+        self.max = max(self.max, seconds)
+
+    def merge(self, other):
+        self.buckets.update(other.buckets)
+        self.count += other.count
+        self.total += other.total
+        self.max = max(self.max, other.max)
+
+    def percentile(self, p):
+        rank = math.ceil(p * self.count)
+        seen = 0
+        for bucket in sorted(self.buckets):
+            seen += self.buckets[bucket]
+            if seen >= rank:
+                return min(self.bound(bucket), self.max)
+        return 0.0
+
+    def to_json(self):
+        return {
+            "count": self.count,
+            "total_s": self.total,
+            "max_s": self.max,
+            "p50_s": self.percentile(0.5),
+            "p99_s": self.percentile(0.99),
+            # [upper bound in seconds, count]
+            "buckets": [
+                [self.bound(bucket), self.buckets[bucket]]
+                for bucket in sorted(self.buckets)
+            ],
+        }
+
+
+class Recipe:
+    def __init__(self, name, title, budget):
+        self.name = name
+        self.title = title
+        # Worker seconds the recipe may use. The budgets used to be spent one
+        # recipe after another on all cores.
+        self.quota = budget * processes
+        self.used = 0.0
+        self.jobs = 0
+        self.next_id = 0
+        self.running = 0
+        # Whether each of the last jobs timed out.
+        self.recent = collections.deque(maxlen=20)
+        self.alive2_timeouts = 0
+        self.mutants = 0
+        self.duplicates = 0
+        self.function_mutants = 0
+        self.latencies = collections.defaultdict(Histogram)
+        self.outcomes = collections.defaultdict(collections.Counter)
+        self.found = None
+        self.stopped = False
+        self.stop_time = None
+        self.resolved = False
+        self.cancel = mp_context.Event()
+
+    def stop(self, cancel):
+        self.stopped = True
+        self.stop_time = time.time()
+        if cancel:
+            self.cancel.set()
+
+    def priority(self):
+        # Fair share by quota. Recipes whose jobs keep timing out get fewer
+        # cores, down to a quarter of their share.
+        avg = self.used / self.jobs if self.jobs else 1.0
+        timeout_rate = sum(self.recent) / len(self.recent) if self.recent else 0
+        share = self.quota * max(0.25, 1 - timeout_rate)
+        return (self.used + self.running * avg) / max(share, 1e-9)
 
 
 def print_check(name, res):
     print(" ", "\u274c" if res else "\u2705", name)
 
 
+def resolve(recipe):
+    recipe.resolved = True
+    if recipe.found is not None:
+        # Only keep the files of the first finding.
+        name, reason = recipe.found
+        for file in os.listdir(work_dir):
+            if file.startswith(recipe.name) and file.split(".")[0] != name:
+                try:
+                    os.remove(os.path.join(work_dir, file))
+                except Exception:
+                    pass
+        if reason != "":
+            print(name, reason)
+    print_check(recipe.title, recipe.found is not None)
+    if recipe.alive2_timeouts:
+        print("  Alive2 timeouts: {}".format(recipe.alive2_timeouts))
+    # stdout is appended to the issue as it goes.
+    sys.stdout.flush()
+
+
+def write_stats(recipes, start, busy):
+    now = time.time()
+    elapsed = max(now - start, 1e-9)
+    report = {
+        "processes": processes,
+        "elapsed_s": elapsed,
+        "utilization": busy / (elapsed * processes),
+        "mutants": sum(recipe.mutants for recipe in recipes),
+        "recipes": dict(),
+    }
+    report["mutants_per_s"] = report["mutants"] / elapsed
+    for recipe in recipes:
+        # Recipes run side by side, each until it stops.
+        recipe_elapsed = max((recipe.stop_time or now) - start, 1e-9)
+        stages = dict()
+        for stage, latencies in recipe.latencies.items():
+            stages[stage] = latencies.to_json()
+            stages[stage]["outcomes"] = dict(recipe.outcomes[stage])
+        report["recipes"][recipe.name] = {
+            "jobs": recipe.jobs,
+            "mutants": recipe.mutants,
+            "mutants_per_s": recipe.mutants / recipe_elapsed,
+            # Share of function mutants the mutate server rejected as
+            # duplicates.
+            "duplicate_rate": recipe.duplicates / max(recipe.function_mutants, 1),
+            "core_s": recipe.used,
+            "utilization": recipe.used / (elapsed * processes),
+            "found": recipe.found is not None,
+            "stages": stages,
+        }
+    # Replaced atomically, as it is rewritten while the campaign runs.
+    with open(stats_file + ".tmp", "w") as f:
+        json.dump(report, f, indent=2)
+    os.replace(stats_file + ".tmp", stats_file)
+    return report
+
+
+def summarize(recipes, report):
+    alive2 = Histogram()
+    outcomes = collections.Counter()
+    for recipe in recipes:
+        if "alive2" in recipe.latencies:
+            alive2.merge(recipe.latencies["alive2"])
+        for counter in recipe.outcomes.values():
+            outcomes.update(counter)
+    return (
+        "{} mutants ({:.1f}/s), {:.0%} utilization, "
+        "alive2 p50 {:.2f}s p99 {:.2f}s, {} timeouts, {} crashes"
+    ).format(
+        report["mutants"],
+        report["mutants_per_s"],
+        report["utilization"],
+        alive2.percentile(0.5),
+        alive2.percentile(0.99),
+        outcomes["timeout"],
+        outcomes["crash"],
+    )
+
+
+def run_checks(recipes):
+    """Runs all recipes concurrently on one pool until each has a finding or
+    has used its quota. The quota a recipe leaves when it stops early goes to
+    the others, and nothing runs past the sum of the budgets. Returns a one-line
+    summary of the stats written to stats_file."""
+    start = time.time()
+    deadline = start + sum(recipe.quota for recipe in recipes) / processes
+    busy = 0.0
+    last_report = start
+
+    def report():
+        elapsed = max(time.time() - start, 1e-9)
+        jobs = ", ".join(f"{recipe.name} {recipe.jobs}" for recipe in recipes)
+        print(
+            "{:.0%} utilization, jobs: {}".format(busy / (elapsed * processes), jobs),
+            file=sys.stderr,
+        )
+        return write_stats(recipes, start, busy)
+
+    with ProcessPoolExecutor(
+        processes,
+        mp_context=mp_context,
+        initializer=init_worker,
+        initargs=({recipe.name: recipe.cancel for recipe in recipes}, deadline),
+    ) as pool:
+        running = dict()
+        while True:
+            now = time.time()
+            for recipe in recipes:
+                if recipe.stopped:
+                    continue
+                if now >= deadline:
+                    recipe.stop(cancel=True)
+                elif recipe.found is not None:
+                    recipe.stop(cancel=True)
+                    active = [r for r in recipes if not r.stopped]
+                    left = max(0.0, recipe.quota - recipe.used)
+                    total = sum(r.quota for r in active)
+                    for other in active:
+                        other.quota += left * other.quota / max(total, 1e-9)
+                    recipe.quota = recipe.used
+                elif recipe.used >= recipe.quota:
+                    recipe.stop(cancel=False)
+            for recipe in recipes:
+                if recipe.stopped and not recipe.running and not recipe.resolved:
+                    resolve(recipe)
+
+            # One job waits behind each running one, so a worker that finishes
+            # never idles until the main loop wakes up.
+            while len(running) < 2 * processes:
+                active = [r for r in recipes if not r.stopped]
+                if not active:
+                    break
+                recipe = min(active, key=Recipe.priority)
+                future = pool.submit(run_job, recipe.name, recipe.next_id)
+                running[future] = recipe
+                recipe.next_id += 1
+                recipe.running += 1
+            if not running:
+                break
+
+            timeout = min(max(deadline - time.time(), 1.0), 10.0)
+            finished, _ = wait(running, timeout=timeout, return_when=FIRST_COMPLETED)
+            for future in finished:
+                recipe = running.pop(future)
+                (filename, res, reason), elapsed, stats = future.result()
+                for stage, seconds, outcome in stats.stages:
+                    recipe.latencies[stage].add(seconds)
+                    recipe.outcomes[stage][outcome] += 1
+                recipe.mutants += stats.mutants
+                recipe.duplicates += stats.duplicates
+                recipe.function_mutants += stats.function_mutants
+                recipe.running -= 1
+                recipe.jobs += 1
+                recipe.used += elapsed
+                busy += elapsed
+                timed_out = not res and reason.endswith("timeout")
+                recipe.recent.append(timed_out)
+                if res and recipe.found is None:
+                    recipe.found = (filename, reason)
+                elif reason == "alive2 timeout":
+                    recipe.alive2_timeouts += 1
+            if time.time() - last_report >= 60:
+                last_report = time.time()
+                report()
+    return summarize(recipes, report())
+
+
 print("Seeds: {}".format(seeds_count))
 print("Pass: `opt -passes={}`".format(pass_name))
+print("RNG seed: {}".format(rng_seed))
 print(
     "Baseline: https://github.com/llvm/llvm-project/commit/{}".format(
         os.environ["LLVM_REVISION"]
@@ -223,22 +501,22 @@ print("Patch SHA256: {}".format(os.environ["PATCH_SHA256"]))
 start = time.time()
 
 print("Checklist:")
+sys.stdout.flush()
 scale = 0.01 if fuzz_mode == "quickfuzz" else 1.0
-# Correctness check
-print_check("Correctness", check("correctness", 3600 * scale))
-
-# Generalization check
-
-## Commutative check
-print_check("Commutative op handling", check("commutative", 300 * scale))
-## Multi-use check
-print_check("Multi-use handling", check("multi-use", 300 * scale))
-## Flag preservation check
-print_check("Flag preservation", check("flag-preserving", 300 * scale))
-## Canonical form check
-print_check("Canonical form handling", check("canonical-form", 300 * scale))
-## TODO: Vector
-## TODO: Drop constraints
+# Verdicts are listed in the order the recipes resolve.
+summary = run_checks(
+    [
+        Recipe("correctness", "Correctness", 3600 * scale),
+        # Generalization checks
+        Recipe("commutative", "Commutative op handling", 300 * scale),
+        Recipe("multi-use", "Multi-use handling", 300 * scale),
+        Recipe("flag-preserving", "Flag preservation", 300 * scale),
+        Recipe("canonical-form", "Canonical form handling", 300 * scale),
+        # TODO: Vector
+        # TODO: Drop constraints
+    ]
+)
 
 end = time.time()
 print("Time: {}".format(time.strftime("%H:%M:%S", time.gmtime(end - start))))
+print("Stats: {}".format(summary))
@@ -1,5 +1,5 @@
 #!/bin/bash
 
 cd build
-python3 ../fuzz.py ../alive2-build/alive-tv ../llvm-build/bin/ ../llvm-project/ . ../patch.diff >> ../issue.md
+FUZZ_STATS=../stats.json python3 ../fuzz.py ../alive2-build/alive-tv ../llvm-build/bin/ ../llvm-project/ . ../patch.diff >> ../issue.md
 cat ../issue.md
@@ -53,37 +53,56 @@ block_list = [
 ]
 
 
-def preprocess(pack):
-    id, file = pack
-    if file in block_list:
-        return None
-    if file.endswith(".ll"):
-        try:
-            orig = os.path.join(test_dir, file)
-            tmp = os.path.join(seed_dir, f"{id}")
-            os.makedirs(tmp)
-            shutil.copyfile(orig, os.path.join(tmp, "orig.ll"))
-            seed = os.path.join(tmp, "seed.ll")
-            merge_ops = []
-            # merge_ops = ['-ignore-fp']
-            subprocess.check_call(
-                [merge_bin, tmp, seed] + merge_ops, stderr=subprocess.DEVNULL
-            )
-            ref_out = os.path.join(tmp, "ref.ll")
-            subprocess.check_call(
-                [llvm_opt, "-passes=" + pass_name, seed, "-o", ref_out, "-S"],
-                stderr=subprocess.DEVNULL,
-            )
-            return (seed, ref_out)
-        except Exception:
-            pass
+# merge parses and filters all the tests on its own threads, and writes a seed
+# for each test that has functions left.
+test_files = [
+    os.path.join(test_dir, file)
+    for file in sorted(os.listdir(test_dir))
+    if file.endswith(".ll") and file not in block_list
+]
+merge_ops = [f"-j={processes}"]
+if os.environ.get("SEED_CACHE"):
+    merge_ops += [
+        "--cache=" + os.environ["SEED_CACHE"],
+        "--cache-tag=" + os.environ.get("LLVM_REVISION", ""),
+    ]
+# DISTILL_BUDGET keeps one function of each shape, at most that many (0 = no
+# limit).
+if os.environ.get("DISTILL_BUDGET"):
+    merge_ops += ["--distill", "--distill-budget=" + os.environ["DISTILL_BUDGET"]]
+# merge_ops.append('-ignore-fp')
+merge_res = subprocess.run(
+    [merge_bin, "--per-seed"] + merge_ops + test_files + [seed_dir],
+    stderr=subprocess.PIPE,
+    text=True,
+)
+# A crash on any test would leave a partial seed dir behind.
+if merge_res.returncode != 0:
+    sys.stderr.write(merge_res.stderr)
+    sys.exit(f"merge failed with exit code {merge_res.returncode}")
+for line in merge_res.stderr.splitlines():
+    if line.startswith("merge: distilled"):
+        print(line)
+
+
+def preprocess(file):
+    try:
+        seed = os.path.join(seed_dir, file)
+        ref_out = os.path.join(seed_dir, file.removesuffix(".ll") + ".ref.ll")
+        subprocess.check_call(
+            [llvm_opt, "-passes=" + pass_name, seed, "-o", ref_out, "-S"],
+            stderr=subprocess.DEVNULL,
+        )
+        return (seed, ref_out)
+    except Exception:
+        pass
 
     return None
 
 
 tests = []
 with Pool(processes) as pool:
-    for res in pool.imap_unordered(preprocess, enumerate(os.listdir(test_dir))):
+    for res in pool.imap_unordered(preprocess, sorted(os.listdir(seed_dir))):
         if res is not None:
             tests.append(res)
 print(f"Valid tests: {len(tests)}")
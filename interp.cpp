@@ -0,0 +1,1593 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "interp.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/FloatingPointMode.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/bit.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/ConstantRange.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GetElementPtrTypeIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Support/MathExtras.h>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+// Each pointer argument points to a block of this many bytes of its own.
+constexpr uint64_t BlockSize = 256;
+constexpr uint64_t BlockAlign = 4096;
+
+using i128 = __int128;
+using u128 = unsigned __int128;
+
+uint64_t getMask(unsigned W) { return W >= 64 ? ~0ULL : (1ULL << W) - 1; }
+
+int64_t toSigned(uint64_t V, unsigned W) {
+  return W >= 64 ? static_cast<int64_t>(V)
+                 : static_cast<int64_t>(V << (64 - W)) >> (64 - W);
+}
+
+bool fitsSigned(i128 V, unsigned W) {
+  i128 Min = -(static_cast<i128>(1) << (W - 1));
+  return V >= Min && V <= -Min - 1;
+}
+
+// The block bases are scattered so that no plausible offset reaches another
+// block from a pointer into one.
+uint64_t getBlockBase(uint32_t Block) {
+  return (Block * 0x9E3779B97F4A7C15ULL) & ~(BlockAlign - 1);
+}
+
+bool isSupportedScalar(Type *Ty) {
+  if (auto *IntTy = dyn_cast<IntegerType>(Ty))
+    return IntTy->getBitWidth() <= 64;
+  if (auto *PtrTy = dyn_cast<PointerType>(Ty))
+    return PtrTy->getAddressSpace() == 0;
+  return Ty->isFloatTy() || Ty->isDoubleTy();
+}
+
+// Number of lane slots a value of type Ty occupies: one per element of a
+// vector, and the elements of a literal struct one after another. 0 if the
+// type is not modelled.
+unsigned getNumSlots(Type *Ty) {
+  if (isSupportedScalar(Ty))
+    return 1;
+  if (auto *VecTy = dyn_cast<FixedVectorType>(Ty)) {
+    Type *EltTy = VecTy->getElementType();
+    return isSupportedScalar(EltTy) && !EltTy->isPointerTy()
+               ? VecTy->getNumElements()
+               : 0;
+  }
+  if (auto *StructTy = dyn_cast<StructType>(Ty)) {
+    unsigned Slots = 0;
+    for (Type *EltTy : StructTy->elements()) {
+      unsigned EltSlots = isa<StructType>(EltTy) ? 0 : getNumSlots(EltTy);
+      if (!EltSlots)
+        return 0;
+      Slots += EltSlots;
+    }
+    return Slots;
+  }
+  return 0;
+}
+
+unsigned getWidth(Type *Ty) {
+  Ty = Ty->getScalarType();
+  if (Ty->isPointerTy())
+    return 64;
+  return Ty->getPrimitiveSizeInBits();
+}
+
+template <typename T> T toFP(uint64_t Bits) {
+  if constexpr (sizeof(T) == 4)
+    return std::bit_cast<float>(static_cast<uint32_t>(Bits));
+  else
+    return std::bit_cast<double>(Bits);
+}
+
+template <typename T> uint64_t fromFP(T V) {
+  if constexpr (sizeof(T) == 4)
+    return std::bit_cast<uint32_t>(V);
+  else
+    return std::bit_cast<uint64_t>(V);
+}
+
+bool isNaN(uint64_t Bits, bool IsDouble) {
+  return IsDouble ? std::isnan(toFP<double>(Bits))
+                  : std::isnan(toFP<float>(Bits));
+}
+
+bool isInf(uint64_t Bits, bool IsDouble) {
+  return IsDouble ? std::isinf(toFP<double>(Bits))
+                  : std::isinf(toFP<float>(Bits));
+}
+
+bool isZero(uint64_t Bits, bool IsDouble) {
+  return (Bits & getMask(IsDouble ? 63 : 31)) == 0;
+}
+
+bool isSignaling(uint64_t Bits, bool IsDouble) {
+  return isNaN(Bits, IsDouble) &&
+         !(Bits & (1ULL << (IsDouble ? 51 : 22)));
+}
+
+FPClassTest classify(uint64_t Bits, bool IsDouble) {
+  bool Neg = Bits >> (IsDouble ? 63 : 31);
+  int Class = IsDouble ? std::fpclassify(toFP<double>(Bits))
+                       : std::fpclassify(toFP<float>(Bits));
+  switch (Class) {
+  case FP_NAN:
+    return isSignaling(Bits, IsDouble) ? fcSNan : fcQNan;
+  case FP_INFINITE:
+    return Neg ? fcNegInf : fcPosInf;
+  case FP_ZERO:
+    return Neg ? fcNegZero : fcPosZero;
+  case FP_SUBNORMAL:
+    return Neg ? fcNegSubnormal : fcPosSubnormal;
+  default:
+    return Neg ? fcNegNormal : fcPosNormal;
+  }
+}
+
+// Values of one IR value in every lane, slot by slot.
+struct Lanes {
+  std::vector<uint64_t> Bits;
+  std::vector<uint8_t> Poison;
+
+  explicit Lanes(size_t Size) : Bits(Size), Poison(Size) {}
+};
+
+// A splitmix64 stream. Inputs are generated from a fixed seed so that the
+// screen gives the same answer for the same pair.
+class InputStream {
+  uint64_t State;
+
+public:
+  explicit InputStream(uint64_t Seed) : State(Seed) {}
+
+  uint64_t operator()() {
+    uint64_t Z = (State += 0x9E3779B97F4A7C15ULL);
+    Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+    return Z ^ (Z >> 31);
+  }
+
+  uint64_t bounded(uint64_t N) {
+    return static_cast<uint64_t>((static_cast<u128>((*this)()) * N) >> 64);
+  }
+};
+
+uint64_t randomInt(InputStream &Gen, unsigned W) {
+  uint64_t Mask = getMask(W);
+  uint64_t SMin = 1ULL << (W - 1);
+  switch (Gen.bounded(6)) {
+  case 0: {
+    const uint64_t Special[] = {0,    1,        2,        Mask,
+                                Mask - 1, SMin, SMin - 1, SMin + 1};
+    return Special[Gen.bounded(std::size(Special))] & Mask;
+  }
+  case 1:
+    return (Gen.bounded(33) - 16) & Mask;
+  case 2:
+    return Gen() & getMask(1 + Gen.bounded(W));
+  case 3:
+    return ((1ULL << Gen.bounded(W)) + Gen.bounded(3) - 1) & Mask;
+  default:
+    return Gen() & Mask;
+  }
+}
+
+template <typename T> uint64_t randomFP(InputStream &Gen) {
+  using Limits = std::numeric_limits<T>;
+  switch (Gen.bounded(5)) {
+  case 0: {
+    const T Special[] = {T(0),
+                         -T(0),
+                         T(1),
+                         T(-1),
+                         Limits::infinity(),
+                         -Limits::infinity(),
+                         Limits::quiet_NaN(),
+                         T(0.5),
+                         T(2),
+                         Limits::min(),
+                         -Limits::min(),
+                         Limits::denorm_min(),
+                         Limits::max(),
+                         Limits::lowest(),
+                         Limits::epsilon()};
+    return fromFP(Special[Gen.bounded(std::size(Special))]);
+  }
+  case 1:
+    return fromFP(static_cast<T>(static_cast<int>(Gen.bounded(33)) - 16));
+  case 2:
+    return fromFP(static_cast<T>(
+        std::ldexp(static_cast<double>(static_cast<int>(Gen.bounded(2001)) -
+                                       1000),
+                   -static_cast<int>(Gen.bounded(11)))));
+  default:
+    return fromFP(toFP<T>(Gen()));
+  }
+}
+
+// The inputs shared by the executions of src and tgt.
+struct Inputs {
+  uint32_t N;
+  std::vector<Lanes> Args;
+  uint32_t NumBlocks = 0;
+  // Initial memory of the blocks, indexed by [Block][Offset][Lane].
+  std::vector<uint8_t> Memory;
+  // Lanes whose inputs violate an attribute of src or tgt.
+  std::vector<uint8_t> Skip;
+};
+
+bool inRange(const Attribute &Range, uint64_t V, unsigned W) {
+  return !Range.isValid() || Range.getRange().contains(APInt(W, V));
+}
+
+// Draws an input for every lane of every argument. Arguments sometimes copy
+// an earlier argument of the same type, as many folds only fire on equal
+// operands. Returns false if an argument cannot be modelled.
+bool generateInputs(const Function &Src, const Function &Tgt, Inputs &In) {
+  const uint32_t N = In.N;
+  InputStream Gen(0x6d75746174696f6eULL ^ Src.arg_size());
+  In.Skip.assign(N, 0);
+  for (const Argument &Arg : Src.args()) {
+    unsigned ArgNo = Arg.getArgNo();
+    const Argument &TgtArg = *Tgt.getArg(ArgNo);
+    Type *Ty = Arg.getType();
+    unsigned Slots = getNumSlots(Ty);
+    if (!Slots || Ty->isStructTy())
+      return false;
+    Lanes Values(Slots * N);
+
+    if (Ty->isPointerTy()) {
+      for (const Argument *A : {&Arg, &TgtArg}) {
+        if (A->hasAttribute(Attribute::ReadOnly) ||
+            A->hasAttribute(Attribute::ReadNone) ||
+            A->hasAttribute(Attribute::WriteOnly) ||
+            A->hasAttribute(Attribute::Initializes) ||
+            A->getDereferenceableBytes() > BlockSize ||
+            A->getDereferenceableOrNullBytes() > BlockSize ||
+            A->getParamAlign().valueOrOne().value() > BlockAlign)
+          return false;
+      }
+      uint64_t Base = getBlockBase(++In.NumBlocks);
+      std::fill(Values.Bits.begin(), Values.Bits.end(), Base);
+      In.Args.push_back(std::move(Values));
+      continue;
+    }
+
+    unsigned W = getWidth(Ty);
+    bool IsFP = Ty->isFPOrFPVectorTy();
+    bool IsDouble = Ty->getScalarType()->isDoubleTy();
+    Attribute Range = Arg.getAttribute(Attribute::Range);
+    Attribute TgtRange = TgtArg.getAttribute(Attribute::Range);
+    FPClassTest NoFPClass = Arg.getNoFPClass() | TgtArg.getNoFPClass();
+    bool Constrained =
+        Range.isValid() || TgtRange.isValid() || NoFPClass != fcNone;
+    std::vector<unsigned> SameType;
+    for (unsigned I = 0; I != ArgNo && !Constrained; ++I)
+      if (Src.getArg(I)->getType() == Ty)
+        SameType.push_back(I);
+
+    for (uint32_t L = 0; L != N; ++L) {
+      if (!SameType.empty() && Gen.bounded(8) == 0) {
+        const Lanes &Other = In.Args[SameType[Gen.bounded(SameType.size())]];
+        for (unsigned S = 0; S != Slots; ++S)
+          Values.Bits[S * N + L] = Other.Bits[S * N + L];
+        continue;
+      }
+      for (unsigned S = 0; S != Slots; ++S) {
+        uint64_t V;
+        if (!IsFP) {
+          V = randomInt(Gen, W);
+          if (Range.isValid() && !inRange(Range, V, W)) {
+            const ConstantRange &CR = Range.getRange();
+            uint64_t Lower = CR.getLower().getZExtValue();
+            uint64_t Size = (CR.getUpper().getZExtValue() - Lower) & getMask(W);
+            V = (Lower + (Size ? V % Size : V)) & getMask(W);
+          }
+          if (!inRange(TgtRange, V, W))
+            In.Skip[L] = 1;
+        } else {
+          V = IsDouble ? randomFP<double>(Gen) : randomFP<float>(Gen);
+          for (unsigned Retry = 0;
+               Retry != 8 && (classify(V, IsDouble) & NoFPClass); ++Retry)
+            V = IsDouble ? randomFP<double>(Gen) : randomFP<float>(Gen);
+          if (classify(V, IsDouble) & NoFPClass)
+            In.Skip[L] = 1;
+        }
+        Values.Bits[S * N + L] = V;
+      }
+    }
+    In.Args.push_back(std::move(Values));
+  }
+
+  In.Memory.resize(In.NumBlocks * BlockSize * N);
+  for (uint32_t Block = 0; Block != In.NumBlocks; ++Block)
+    for (uint32_t L = 0; L != N; ++L) {
+      bool Zero = Gen.bounded(4) == 0;
+      for (uint64_t Off = 0; Off != BlockSize; ++Off)
+        In.Memory[(Block * BlockSize + Off) * N + L] =
+            Zero ? 0 : static_cast<uint8_t>(Gen());
+    }
+  return true;
+}
+
+// Evaluates a loop-free function on all lanes at once. Blocks are visited in
+// reverse post order with the lanes that entered them; each lane remembers
+// its predecessor for the phis. Lanes stop being active once they hit
+// undefined behavior.
+class Execution {
+  const Function &F;
+  const DataLayout &DL;
+  const Inputs &In;
+  const uint32_t N;
+  const bool IsSrc;
+  DenseMap<const Value *, std::unique_ptr<Lanes>> Values;
+  // Predecessor each lane entered a block from, or nullptr.
+  DenseMap<const BasicBlock *, std::vector<const BasicBlock *>> EnteredFrom;
+  std::vector<uint8_t> Active;
+
+public:
+  std::vector<uint8_t> UB;
+  // Lanes on which src made a nondeterministic choice that the screen
+  // cannot enumerate.
+  std::vector<uint8_t> Nondet;
+  std::vector<uint8_t> Returned;
+  std::unique_ptr<Lanes> Result;
+  std::vector<uint8_t> Memory;
+  std::vector<uint8_t> MemoryPoison;
+
+  Execution(const Function &F, const Inputs &In, bool IsSrc)
+      : F(F), DL(F.getParent()->getDataLayout()), In(In), N(In.N),
+        IsSrc(IsSrc), Active(N), UB(N), Nondet(N), Returned(N),
+        Memory(In.Memory), MemoryPoison(In.Memory.size()) {
+    for (const Argument &Arg : F.args())
+      Values[&Arg] = std::make_unique<Lanes>(In.Args[Arg.getArgNo()]);
+  }
+
+  bool run();
+
+private:
+  void setUB(uint32_t L) {
+    if (Active[L])
+      UB[L] = 1;
+  }
+
+  void setNondet(uint32_t L) {
+    if (IsSrc && Active[L])
+      Nondet[L] = 1;
+  }
+
+  Lanes &define(const Value &V, unsigned Slots) {
+    auto &Slot = Values[&V];
+    Slot = std::make_unique<Lanes>(Slots * N);
+    return *Slot;
+  }
+
+  const Lanes *get(const Value *V);
+  std::optional<size_t> getByteIndex(uint64_t Addr, uint64_t Size,
+                                     uint64_t Align, uint32_t L) const;
+  bool applyRetAttrs(AttributeSet Attrs, Type *Ty, Lanes &R);
+  bool applyFMF(const Instruction &I, Lanes &R);
+  void enter(const BasicBlock *Succ, const BasicBlock *From, uint32_t L);
+
+  bool evalIntBinOp(const BinaryOperator &I, Lanes &R);
+  bool evalFPBinOp(const Instruction &I, Lanes &R);
+  bool evalCast(const CastInst &I, Lanes &R);
+  bool evalCmp(const CmpInst &I, Lanes &R);
+  bool evalIntrinsic(const IntrinsicInst &II, Lanes &R);
+  bool evalGEP(const GetElementPtrInst &GEP, Lanes &R);
+  bool evalLoad(const LoadInst &LI, Lanes &R);
+  bool evalStore(const StoreInst &SI);
+  bool evalTerminator(const Instruction &I);
+  bool eval(const Instruction &I,
+            const std::vector<const BasicBlock *> &From);
+};
+
+const Lanes *Execution::get(const Value *V) {
+  auto It = Values.find(V);
+  if (It != Values.end())
+    return It->second.get();
+  auto *C = dyn_cast<Constant>(V);
+  if (!C)
+    return nullptr;
+  unsigned Slots = getNumSlots(C->getType());
+  if (!Slots || C->getType()->isStructTy())
+    return nullptr;
+  Lanes Splat(Slots * N);
+  for (unsigned S = 0; S != Slots; ++S) {
+    const Constant *Elt =
+        C->getType()->isVectorTy() ? C->getAggregateElement(S) : C;
+    if (!Elt)
+      return nullptr;
+    uint64_t Bits;
+    bool Poison = false;
+    if (isa<PoisonValue>(Elt))
+      Poison = true, Bits = 0;
+    else if (auto *CI = dyn_cast<ConstantInt>(Elt))
+      Bits = CI->getZExtValue();
+    else if (auto *CF = dyn_cast<ConstantFP>(Elt))
+      Bits = CF->getValueAPF().bitcastToAPInt().getZExtValue();
+    else if (isa<ConstantPointerNull>(Elt))
+      Bits = 0;
+    else
+      return nullptr;
+    std::fill_n(Splat.Bits.begin() + S * N, N, Bits);
+    std::fill_n(Splat.Poison.begin() + S * N, N, Poison);
+  }
+  auto &Slot = Values[V];
+  Slot = std::make_unique<Lanes>(std::move(Splat));
+  return Slot.get();
+}
+
+std::optional<size_t> Execution::getByteIndex(uint64_t Addr, uint64_t Size,
+                                              uint64_t Align,
+                                              uint32_t L) const {
+  for (uint32_t Block = 1; Block <= In.NumBlocks; ++Block) {
+    uint64_t Off = Addr - getBlockBase(Block);
+    if (Off >= BlockSize)
+      continue;
+    if (Off + Size > BlockSize || Off % Align)
+      return std::nullopt;
+    return ((Block - 1) * BlockSize + Off) * N + L;
+  }
+  return std::nullopt;
+}
+
+// Applies the noundef, range and nofpclass return attributes of a function
+// or an intrinsic call. Others are not modelled.
+bool Execution::applyRetAttrs(AttributeSet Attrs, Type *Ty, Lanes &R) {
+  for (const Attribute &Attr : Attrs) {
+    if (Attr.isStringAttribute())
+      return false;
+    switch (Attr.getKindAsEnum()) {
+    case Attribute::NoUndef:
+    case Attribute::Range:
+    case Attribute::NoFPClass:
+      break;
+    default:
+      return false;
+    }
+  }
+  if (Ty->isVoidTy())
+    return true;
+  unsigned Slots = getNumSlots(Ty);
+  unsigned W = getWidth(Ty);
+  bool IsDouble = Ty->getScalarType()->isDoubleTy();
+  Attribute Range = Attrs.getAttribute(Attribute::Range);
+  FPClassTest NoFPClass = Attrs.getNoFPClass();
+  for (unsigned S = 0; S != Slots; ++S)
+    for (uint32_t L = 0; L != N; ++L) {
+      size_t Idx = S * N + L;
+      if (R.Poison[Idx])
+        continue;
+      if (!inRange(Range, R.Bits[Idx], W) ||
+          (NoFPClass && (classify(R.Bits[Idx], IsDouble) & NoFPClass)))
+        R.Poison[Idx] = 1;
+    }
+  if (Attrs.hasAttribute(Attribute::NoUndef))
+    for (unsigned S = 0; S != Slots; ++S)
+      for (uint32_t L = 0; L != N; ++L)
+        if (R.Poison[S * N + L])
+          setUB(L);
+  return true;
+}
+
+// nnan and ninf turn NaN and infinite operands and results into poison. The
+// other fast-math flags relax src to a set of results, which is not
+// enumerated; tgt may pick the exact one.
+bool Execution::applyFMF(const Instruction &I, Lanes &R) {
+  auto *FPOp = dyn_cast<FPMathOperator>(&I);
+  if (!FPOp)
+    return true;
+  FastMathFlags FMF = FPOp->getFastMathFlags();
+  if (IsSrc && (FMF.allowReassoc() || FMF.allowReciprocal() ||
+                FMF.allowContract() || FMF.approxFunc()))
+    return false;
+  if (!FMF.noNaNs() && !FMF.noInfs() && !FMF.noSignedZeros())
+    return true;
+
+  unsigned Slots = getNumSlots(I.getType());
+  auto Check = [&](const Lanes &V, bool IsDouble, bool IsResult) {
+    for (unsigned S = 0; S != Slots; ++S)
+      for (uint32_t L = 0; L != N; ++L) {
+        size_t Idx = S * N + L;
+        if ((FMF.noNaNs() && isNaN(V.Bits[Idx], IsDouble)) ||
+            (FMF.noInfs() && isInf(V.Bits[Idx], IsDouble)))
+          R.Poison[Idx] = 1;
+        else if (IsResult && FMF.noSignedZeros() && !R.Poison[Idx] &&
+                 isZero(V.Bits[Idx], IsDouble))
+          setNondet(L);
+      }
+  };
+  auto Operands = isa<CallBase>(I) ? cast<CallBase>(I).args() : I.operands();
+  for (const Use &U : Operands) {
+    Type *Ty = U->getType();
+    if (!Ty->isFPOrFPVectorTy() || getNumSlots(Ty) != Slots)
+      continue;
+    const Lanes *V = get(U.get());
+    if (!V)
+      return false;
+    Check(*V, Ty->getScalarType()->isDoubleTy(), /*IsResult=*/false);
+  }
+  if (I.getType()->isFPOrFPVectorTy())
+    Check(R, I.getType()->getScalarType()->isDoubleTy(), /*IsResult=*/true);
+  return true;
+}
+
+bool Execution::evalIntBinOp(const BinaryOperator &I, Lanes &R) {
+  const Lanes *A = get(I.getOperand(0));
+  const Lanes *B = get(I.getOperand(1));
+  if (!A || !B)
+    return false;
+  unsigned W = getWidth(I.getType());
+  unsigned Slots = getNumSlots(I.getType());
+  uint64_t Mask = getMask(W);
+  unsigned Opc = I.getOpcode();
+  bool NUW = isa<OverflowingBinaryOperator>(I) && I.hasNoUnsignedWrap();
+  bool NSW = isa<OverflowingBinaryOperator>(I) && I.hasNoSignedWrap();
+  bool Exact = isa<PossiblyExactOperator>(I) && I.isExact();
+  bool Disjoint = isa<PossiblyDisjointInst>(I) &&
+                  cast<PossiblyDisjointInst>(I).isDisjoint();
+  int64_t SMin = toSigned(1ULL << (W - 1), W);
+
+  for (unsigned S = 0; S != Slots; ++S)
+    for (uint32_t L = 0; L != N; ++L) {
+      size_t Idx = S * N + L;
+      uint64_t X = A->Bits[Idx], Y = B->Bits[Idx];
+      int64_t SX = toSigned(X, W), SY = toSigned(Y, W);
+      bool Poison = A->Poison[Idx] || B->Poison[Idx];
+      uint64_t V = 0;
+      switch (Opc) {
+      case Instruction::Add:
+        V = X + Y;
+        Poison |= (NUW && static_cast<u128>(X) + Y > Mask) ||
+                  (NSW && !fitsSigned(static_cast<i128>(SX) + SY, W));
+        break;
+      case Instruction::Sub:
+        V = X - Y;
+        Poison |= (NUW && X < Y) ||
+                  (NSW && !fitsSigned(static_cast<i128>(SX) - SY, W));
+        break;
+      case Instruction::Mul:
+        V = X * Y;
+        Poison |= (NUW && static_cast<u128>(X) * Y > Mask) ||
+                  (NSW && !fitsSigned(static_cast<i128>(SX) * SY, W));
+        break;
+      case Instruction::UDiv:
+      case Instruction::URem:
+        if (B->Poison[Idx] || Y == 0) {
+          setUB(L);
+          break;
+        }
+        V = Opc == Instruction::UDiv ? X / Y : X % Y;
+        Poison |= Exact && X % Y;
+        break;
+      case Instruction::SDiv:
+      case Instruction::SRem:
+        if (B->Poison[Idx] || Y == 0 || (SX == SMin && SY == -1)) {
+          setUB(L);
+          break;
+        }
+        V = Opc == Instruction::SDiv ? SX / SY : SX % SY;
+        Poison |= Exact && SX % SY;
+        break;
+      case Instruction::Shl:
+        if (Y >= W) {
+          Poison = true;
+          break;
+        }
+        V = (X << Y) & Mask;
+        Poison |= (NUW && (V >> Y) != X) ||
+                  (NSW && (toSigned(V, W) >> Y) != SX);
+        break;
+      case Instruction::LShr:
+      case Instruction::AShr:
+        if (Y >= W) {
+          Poison = true;
+          break;
+        }
+        V = Opc == Instruction::LShr ? X >> Y : SX >> Y;
+        Poison |= Exact && (X & getMask(Y));
+        break;
+      case Instruction::And:
+        V = X & Y;
+        break;
+      case Instruction::Or:
+        V = X | Y;
+        Poison |= Disjoint && (X & Y);
+        break;
+      case Instruction::Xor:
+        V = X ^ Y;
+        break;
+      default:
+        return false;
+      }
+      R.Bits[Idx] = V & Mask;
+      R.Poison[Idx] = Poison;
+    }
+  return true;
+}
+
+template <typename T>
+uint64_t computeFPBinOp(unsigned Opc, uint64_t A, uint64_t B) {
+  T X = toFP<T>(A), Y = toFP<T>(B);
+  switch (Opc) {
+  case Instruction::FAdd:
+    return fromFP<T>(X + Y);
+  case Instruction::FSub:
+    return fromFP<T>(X - Y);
+  case Instruction::FMul:
+    return fromFP<T>(X * Y);
+  case Instruction::FDiv:
+    return fromFP<T>(X / Y);
+  default:
+    return fromFP<T>(std::fmod(X, Y));
+  }
+}
+
+bool Execution::evalFPBinOp(const Instruction &I, Lanes &R) {
+  unsigned Slots = getNumSlots(I.getType());
+  bool IsDouble = I.getType()->getScalarType()->isDoubleTy();
+  const Lanes *A = get(I.getOperand(0));
+  if (!A)
+    return false;
+  if (I.getOpcode() == Instruction::FNeg) {
+    uint64_t SignBit = 1ULL << (IsDouble ? 63 : 31);
+    for (size_t Idx = 0; Idx != Slots * N; ++Idx) {
+      R.Bits[Idx] = A->Bits[Idx] ^ SignBit;
+      R.Poison[Idx] = A->Poison[Idx];
+    }
+    return true;
+  }
+  const Lanes *B = get(I.getOperand(1));
+  if (!B)
+    return false;
+  for (size_t Idx = 0; Idx != Slots * N; ++Idx) {
+    R.Bits[Idx] =
+        IsDouble
+            ? computeFPBinOp<double>(I.getOpcode(), A->Bits[Idx], B->Bits[Idx])
+            : computeFPBinOp<float>(I.getOpcode(), A->Bits[Idx], B->Bits[Idx]);
+    R.Poison[Idx] = A->Poison[Idx] || B->Poison[Idx];
+  }
+  return true;
+}
+
+// Converts an FP value to an integer of width W, or nullopt if the value is
+// NaN or out of range.
+std::optional<uint64_t> convertFPToInt(double V, unsigned W, bool Signed) {
+  if (std::isnan(V))
+    return std::nullopt;
+  double T = std::trunc(V);
+  if (Signed) {
+    double Bound = std::ldexp(1.0, W - 1);
+    if (T < -Bound || T >= Bound)
+      return std::nullopt;
+    return static_cast<uint64_t>(static_cast<int64_t>(T)) & getMask(W);
+  }
+  if (T < 0 || T >= std::ldexp(1.0, W))
+    return std::nullopt;
+  return static_cast<uint64_t>(T);
+}
+
+bool Execution::evalCast(const CastInst &I, Lanes &R) {
+  const Lanes *A = get(I.getOperand(0));
+  if (!A)
+    return false;
+  Type *SrcTy = I.getSrcTy(), *DstTy = I.getDestTy();
+  unsigned SrcW = getWidth(SrcTy), DstW = getWidth(DstTy);
+  bool SrcDouble = SrcTy->getScalarType()->isDoubleTy();
+  bool DstDouble = DstTy->getScalarType()->isDoubleTy();
+  unsigned Slots = getNumSlots(DstTy);
+  unsigned Opc = I.getOpcode();
+  bool NUW = false, NSW = false, NNeg = false;
+  if (auto *Trunc = dyn_cast<TruncInst>(&I)) {
+    NUW = Trunc->hasNoUnsignedWrap();
+    NSW = Trunc->hasNoSignedWrap();
+  }
+  if (isa<PossiblyNonNegInst>(I))
+    NNeg = I.hasNonNeg();
+
+  for (size_t Idx = 0; Idx != Slots * N; ++Idx) {
+    uint64_t X = A->Bits[Idx];
+    bool Poison = A->Poison[Idx];
+    uint64_t V = 0;
+    double FP = SrcDouble ? toFP<double>(X) : toFP<float>(X);
+    switch (Opc) {
+    case Instruction::Trunc:
+      V = X & getMask(DstW);
+      Poison |= (NUW && V != X) ||
+                (NSW && toSigned(V, DstW) != toSigned(X, SrcW));
+      break;
+    case Instruction::ZExt:
+      V = X;
+      Poison |= NNeg && toSigned(X, SrcW) < 0;
+      break;
+    case Instruction::SExt:
+      V = toSigned(X, SrcW) & getMask(DstW);
+      break;
+    case Instruction::FPTrunc:
+    case Instruction::FPExt:
+      V = DstDouble ? fromFP(FP) : fromFP(static_cast<float>(FP));
+      break;
+    case Instruction::FPToUI:
+    case Instruction::FPToSI:
+      if (auto Int = convertFPToInt(FP, DstW, Opc == Instruction::FPToSI))
+        V = *Int;
+      else
+        Poison = true;
+      break;
+    case Instruction::UIToFP:
+      Poison |= NNeg && toSigned(X, SrcW) < 0;
+      V = DstDouble ? fromFP(static_cast<double>(X))
+                    : fromFP(static_cast<float>(X));
+      break;
+    case Instruction::SIToFP:
+      V = DstDouble ? fromFP(static_cast<double>(toSigned(X, SrcW)))
+                    : fromFP(static_cast<float>(toSigned(X, SrcW)));
+      break;
+    case Instruction::PtrToInt:
+      V = X & getMask(DstW);
+      break;
+    default:
+      return false;
+    }
+    R.Bits[Idx] = V;
+    R.Poison[Idx] = Poison;
+  }
+  return true;
+}
+
+bool computeICmp(CmpInst::Predicate Pred, uint64_t X, uint64_t Y, unsigned W) {
+  int64_t SX = toSigned(X, W), SY = toSigned(Y, W);
+  switch (Pred) {
+  case CmpInst::ICMP_EQ:
+    return X == Y;
+  case CmpInst::ICMP_NE:
+    return X != Y;
+  case CmpInst::ICMP_UGT:
+    return X > Y;
+  case CmpInst::ICMP_UGE:
+    return X >= Y;
+  case CmpInst::ICMP_ULT:
+    return X < Y;
+  case CmpInst::ICMP_ULE:
+    return X <= Y;
+  case CmpInst::ICMP_SGT:
+    return SX > SY;
+  case CmpInst::ICMP_SGE:
+    return SX >= SY;
+  case CmpInst::ICMP_SLT:
+    return SX < SY;
+  default:
+    return SX <= SY;
+  }
+}
+
+bool computeFCmp(CmpInst::Predicate Pred, double X, double Y) {
+  bool Unordered = std::isnan(X) || std::isnan(Y);
+  switch (Pred) {
+  case CmpInst::FCMP_FALSE:
+    return false;
+  case CmpInst::FCMP_OEQ:
+    return !Unordered && X == Y;
+  case CmpInst::FCMP_OGT:
+    return !Unordered && X > Y;
+  case CmpInst::FCMP_OGE:
+    return !Unordered && X >= Y;
+  case CmpInst::FCMP_OLT:
+    return !Unordered && X < Y;
+  case CmpInst::FCMP_OLE:
+    return !Unordered && X <= Y;
+  case CmpInst::FCMP_ONE:
+    return !Unordered && X != Y;
+  case CmpInst::FCMP_ORD:
+    return !Unordered;
+  case CmpInst::FCMP_UNO:
+    return Unordered;
+  case CmpInst::FCMP_UEQ:
+    return Unordered || X == Y;
+  case CmpInst::FCMP_UGT:
+    return Unordered || X > Y;
+  case CmpInst::FCMP_UGE:
+    return Unordered || X >= Y;
+  case CmpInst::FCMP_ULT:
+    return Unordered || X < Y;
+  case CmpInst::FCMP_ULE:
+    return Unordered || X <= Y;
+  case CmpInst::FCMP_UNE:
+    return Unordered || X != Y;
+  default:
+    return true;
+  }
+}
+
+bool Execution::evalCmp(const CmpInst &I, Lanes &R) {
+  const Lanes *A = get(I.getOperand(0));
+  const Lanes *B = get(I.getOperand(1));
+  if (!A || !B)
+    return false;
+  Type *OpTy = I.getOperand(0)->getType();
+  unsigned W = getWidth(OpTy);
+  bool IsDouble = OpTy->getScalarType()->isDoubleTy();
+  bool SameSign = isa<ICmpInst>(I) && cast<ICmpInst>(I).hasSameSign();
+  unsigned Slots = getNumSlots(I.getType());
+  CmpInst::Predicate Pred = I.getPredicate();
+  for (size_t Idx = 0; Idx != Slots * N; ++Idx) {
+    uint64_t X = A->Bits[Idx], Y = B->Bits[Idx];
+    bool Poison = A->Poison[Idx] || B->Poison[Idx];
+    if (isa<ICmpInst>(I)) {
+      R.Bits[Idx] = computeICmp(Pred, X, Y, W);
+      Poison |= SameSign && ((X ^ Y) >> (W - 1));
+    } else if (IsDouble) {
+      R.Bits[Idx] = computeFCmp(Pred, toFP<double>(X), toFP<double>(Y));
+    } else {
+      R.Bits[Idx] = computeFCmp(Pred, toFP<float>(X), toFP<float>(Y));
+    }
+    R.Poison[Idx] = Poison;
+  }
+  return true;
+}
+
+template <typename T> uint64_t evalFMA(uint64_t A, uint64_t B, uint64_t C) {
+  return fromFP<T>(std::fma(toFP<T>(A), toFP<T>(B), toFP<T>(C)));
+}
+
+template <typename T> uint64_t evalMulAdd(uint64_t A, uint64_t B, uint64_t C) {
+  T Product = toFP<T>(A) * toFP<T>(B);
+  return fromFP<T>(Product + toFP<T>(C));
+}
+
+// minnum/maxnum (IEEE) and minimumnum/maximumnum return the other operand of
+// a NaN; minimum/maximum propagate NaNs. Only minnum/maxnum leave the order
+// of zeros open.
+template <typename T>
+uint64_t evalMinMax(Intrinsic::ID ID, uint64_t A, uint64_t B,
+                    bool &ZeroChoice) {
+  T X = toFP<T>(A), Y = toFP<T>(B);
+  bool IsMin = ID == Intrinsic::minnum || ID == Intrinsic::minimum ||
+               ID == Intrinsic::minimumnum;
+  bool PropagateNaN = ID == Intrinsic::minimum || ID == Intrinsic::maximum;
+  if (std::isnan(X) || std::isnan(Y)) {
+    if (PropagateNaN || (std::isnan(X) && std::isnan(Y)))
+      return fromFP<T>(std::numeric_limits<T>::quiet_NaN());
+    return std::isnan(X) ? B : A;
+  }
+  if (X == 0 && Y == 0 && A != B) {
+    if (ID == Intrinsic::minnum || ID == Intrinsic::maxnum)
+      ZeroChoice = true;
+    return IsMin == std::signbit(X) ? A : B;
+  }
+  return (IsMin ? X < Y : X > Y) ? A : B;
+}
+
+bool Execution::evalIntrinsic(const IntrinsicInst &II, Lanes &R) {
+  if (II.hasOperandBundles())
+    return false;
+  Intrinsic::ID ID = II.getIntrinsicID();
+  SmallVector<const Lanes *, 3> Args;
+  for (const Use &Arg : II.args()) {
+    const Lanes *V = get(Arg.get());
+    if (!V)
+      return false;
+    Args.push_back(V);
+  }
+
+  if (ID == Intrinsic::assume) {
+    for (uint32_t L = 0; L != N; ++L)
+      if (Args[0]->Poison[L] || !Args[0]->Bits[L])
+        setUB(L);
+    return true;
+  }
+
+  Type *OpTy = II.getArgOperand(0)->getType();
+  unsigned W = getWidth(OpTy);
+  uint64_t Mask = getMask(W);
+  bool IsDouble = OpTy->getScalarType()->isDoubleTy();
+  unsigned Slots = getNumSlots(OpTy);
+  int64_t SMin = toSigned(1ULL << (W - 1), W);
+  int64_t SMax = static_cast<int64_t>(Mask >> 1);
+  auto getFlag = [&](unsigned ArgNo) {
+    return !cast<ConstantInt>(II.getArgOperand(ArgNo))->isZero();
+  };
+
+  for (unsigned S = 0; S != Slots; ++S)
+    for (uint32_t L = 0; L != N; ++L) {
+      size_t Idx = S * N + L;
+      // Flags such as the one of ctlz are scalar constants.
+      auto getArg = [&](unsigned ArgNo) {
+        const Lanes *Arg = Args[ArgNo];
+        return Arg->Bits[Arg->Bits.size() == Slots * N ? Idx : L];
+      };
+      bool Poison = false;
+      for (const Lanes *Arg : Args)
+        Poison |= Arg->Poison[Arg->Bits.size() == Slots * N ? Idx : L];
+      uint64_t X = getArg(0);
+      uint64_t Y = Args.size() > 1 ? getArg(1) : 0;
+      int64_t SX = toSigned(X, W), SY = toSigned(Y, W);
+      uint64_t V = 0;
+      // Second result of the *.with.overflow intrinsics.
+      bool Overflow = false;
+      switch (ID) {
+      case Intrinsic::umax:
+        V = std::max(X, Y);
+        break;
+      case Intrinsic::umin:
+        V = std::min(X, Y);
+        break;
+      case Intrinsic::smax:
+        V = SX > SY ? X : Y;
+        break;
+      case Intrinsic::smin:
+        V = SX < SY ? X : Y;
+        break;
+      case Intrinsic::abs:
+        Poison |= getFlag(1) && SX == SMin;
+        V = SX < 0 ? -X : X;
+        break;
+      case Intrinsic::ctlz:
+        Poison |= getFlag(1) && X == 0;
+        V = X ? countl_zero(X) - (64 - W) : W;
+        break;
+      case Intrinsic::cttz:
+        Poison |= getFlag(1) && X == 0;
+        V = X ? countr_zero(X) : W;
+        break;
+      case Intrinsic::ctpop:
+        V = popcount(X);
+        break;
+      case Intrinsic::bitreverse:
+        V = reverseBits(X) >> (64 - W);
+        break;
+      case Intrinsic::bswap:
+        V = byteswap(X) >> (64 - W);
+        break;
+      case Intrinsic::fshl:
+      case Intrinsic::fshr: {
+        uint64_t Shift = getArg(2) % W;
+        if (!Shift)
+          V = ID == Intrinsic::fshl ? X : Y;
+        else if (ID == Intrinsic::fshl)
+          V = (X << Shift) | (Y >> (W - Shift));
+        else
+          V = (X << (W - Shift)) | (Y >> Shift);
+        break;
+      }
+      case Intrinsic::uadd_sat:
+        V = static_cast<u128>(X) + Y > Mask ? Mask : X + Y;
+        break;
+      case Intrinsic::usub_sat:
+        V = X < Y ? 0 : X - Y;
+        break;
+      case Intrinsic::sadd_sat:
+      case Intrinsic::ssub_sat: {
+        i128 Sum = ID == Intrinsic::sadd_sat ? static_cast<i128>(SX) + SY
+                                             : static_cast<i128>(SX) - SY;
+        V = Sum < SMin ? SMin : Sum > SMax ? SMax : static_cast<int64_t>(Sum);
+        break;
+      }
+      case Intrinsic::ushl_sat:
+        Poison |= Y >= W;
+        V = Y >= W ? 0 : ((X << Y) & Mask) >> Y != X ? Mask : X << Y;
+        break;
+      case Intrinsic::sshl_sat:
+        Poison |= Y >= W;
+        if (Y >= W)
+          break;
+        V = toSigned((X << Y) & Mask, W) >> Y != SX ? (SX < 0 ? SMin : SMax)
+                                                    : X << Y;
+        break;
+      case Intrinsic::uadd_with_overflow:
+        V = X + Y;
+        Overflow = static_cast<u128>(X) + Y > Mask;
+        break;
+      case Intrinsic::usub_with_overflow:
+        V = X - Y;
+        Overflow = X < Y;
+        break;
+      case Intrinsic::umul_with_overflow:
+        V = X * Y;
+        Overflow = static_cast<u128>(X) * Y > Mask;
+        break;
+      case Intrinsic::sadd_with_overflow:
+        V = X + Y;
+        Overflow = !fitsSigned(static_cast<i128>(SX) + SY, W);
+        break;
+      case Intrinsic::ssub_with_overflow:
+        V = X - Y;
+        Overflow = !fitsSigned(static_cast<i128>(SX) - SY, W);
+        break;
+      case Intrinsic::smul_with_overflow:
+        V = X * Y;
+        Overflow = !fitsSigned(static_cast<i128>(SX) * SY, W);
+        break;
+      case Intrinsic::scmp:
+      case Intrinsic::ucmp: {
+        bool Signed = ID == Intrinsic::scmp;
+        bool Less = Signed ? SX < SY : X < Y;
+        bool Greater = Signed ? SX > SY : X > Y;
+        V = Less ? ~0ULL : Greater ? 1 : 0;
+        break;
+      }
+      case Intrinsic::fabs:
+        V = X & getMask(W - 1);
+        break;
+      case Intrinsic::copysign:
+        // The sign of a NaN produced by arithmetic is not specified.
+        if (isNaN(Y, IsDouble))
+          setNondet(L);
+        V = (X & getMask(W - 1)) | (Y & ~getMask(W - 1) & Mask);
+        break;
+      case Intrinsic::fma:
+        V = IsDouble ? evalFMA<double>(X, Y, getArg(2))
+                     : evalFMA<float>(X, Y, getArg(2));
+        break;
+      case Intrinsic::fmuladd: {
+        uint64_t Z = getArg(2);
+        V = IsDouble ? evalMulAdd<double>(X, Y, Z) : evalMulAdd<float>(X, Y, Z);
+        uint64_t Fused =
+            IsDouble ? evalFMA<double>(X, Y, Z) : evalFMA<float>(X, Y, Z);
+        if (Fused != V && !(isNaN(Fused, IsDouble) && isNaN(V, IsDouble)))
+          setNondet(L);
+        break;
+      }
+      case Intrinsic::minnum:
+      case Intrinsic::maxnum:
+      case Intrinsic::minimum:
+      case Intrinsic::maximum:
+      case Intrinsic::minimumnum:
+      case Intrinsic::maximumnum: {
+        bool ZeroChoice = false;
+        V = IsDouble ? evalMinMax<double>(ID, X, Y, ZeroChoice)
+                     : evalMinMax<float>(ID, X, Y, ZeroChoice);
+        if (ZeroChoice || isSignaling(X, IsDouble) ||
+            isSignaling(Y, IsDouble))
+          setNondet(L);
+        break;
+      }
+      case Intrinsic::canonicalize:
+        V = isNaN(X, IsDouble) ? X | (1ULL << (IsDouble ? 51 : 22)) : X;
+        break;
+      case Intrinsic::is_fpclass: {
+        auto Test = static_cast<FPClassTest>(
+            cast<ConstantInt>(II.getArgOperand(1))->getZExtValue());
+        FPClassTest Class = classify(X, IsDouble);
+        // Arithmetic may return either kind of NaN.
+        if ((Class & fcNan) && (Test & fcNan) != fcNone &&
+            (Test & fcNan) != fcNan)
+          setNondet(L);
+        V = (Class & Test) != fcNone;
+        break;
+      }
+      default:
+        return false;
+      }
+      Type *RetTy = II.getType();
+      if (RetTy->isStructTy()) {
+        R.Bits[Idx] = V & Mask;
+        R.Poison[Idx] = Poison;
+        R.Bits[(Slots + S) * N + L] = Overflow;
+        R.Poison[(Slots + S) * N + L] = Poison;
+      } else {
+        R.Bits[Idx] = V & getMask(getWidth(RetTy));
+        R.Poison[Idx] = Poison;
+      }
+    }
+  return applyRetAttrs(II.getAttributes().getRetAttrs(), II.getType(), R);
+}
+
+bool Execution::evalGEP(const GetElementPtrInst &GEP, Lanes &R) {
+  if (GEP.getType()->isVectorTy() ||
+      DL.getIndexTypeSizeInBits(GEP.getType()) != 64)
+    return false;
+  const Lanes *Base = get(GEP.getPointerOperand());
+  if (!Base)
+    return false;
+
+  struct Step {
+    const Lanes *Index;
+    unsigned Width;
+    uint64_t Scale;
+    uint64_t Offset;
+  };
+  SmallVector<Step, 4> Steps;
+  for (gep_type_iterator GTI = gep_type_begin(GEP), E = gep_type_end(GEP);
+       GTI != E; ++GTI) {
+    const Value *Op = GTI.getOperand();
+    if (StructType *StructTy = GTI.getStructTypeOrNull()) {
+      uint64_t Field = cast<ConstantInt>(Op)->getZExtValue();
+      Steps.push_back({nullptr, 0, 0,
+                       DL.getStructLayout(StructTy)->getElementOffset(Field)});
+      continue;
+    }
+    const Lanes *Index = get(Op);
+    if (!Index || Op->getType()->isVectorTy())
+      return false;
+    Steps.push_back({Index, getWidth(Op->getType()),
+                     DL.getTypeAllocSize(GTI.getIndexedType()).getFixedValue(),
+                     0});
+  }
+
+  bool InBounds = GEP.isInBounds();
+  bool NUSW = GEP.hasNoUnsignedSignedWrap();
+  bool NUW = GEP.hasNoUnsignedWrap();
+  for (uint32_t L = 0; L != N; ++L) {
+    uint64_t Addr = Base->Bits[L];
+    bool Poison = Base->Poison[L];
+    i128 Offset = 0;
+    u128 UOffset = 0;
+    bool SignedWrap = false, UnsignedWrap = false;
+    for (const Step &S : Steps) {
+      if (!S.Index) {
+        Offset += S.Offset;
+        UOffset += S.Offset;
+        continue;
+      }
+      Poison |= S.Index->Poison[L];
+      int64_t Index = toSigned(S.Index->Bits[L], S.Width);
+      i128 Product = static_cast<i128>(Index) * S.Scale;
+      u128 UProduct = static_cast<u128>(static_cast<uint64_t>(Index)) * S.Scale;
+      SignedWrap |= !fitsSigned(Product, 64);
+      UnsignedWrap |= UProduct > ~0ULL;
+      Offset += Product;
+      UOffset += UProduct;
+      SignedWrap |= !fitsSigned(Offset, 64);
+      UnsignedWrap |= UOffset > ~0ULL;
+    }
+    i128 Result = static_cast<i128>(Addr) + Offset;
+    if (NUSW)
+      Poison |= SignedWrap || Result < 0 || Result > static_cast<i128>(~0ULL);
+    if (NUW)
+      Poison |= UnsignedWrap || static_cast<u128>(Addr) + UOffset > ~0ULL;
+    if (InBounds) {
+      auto InBlock = [&](uint64_t Ptr, uint32_t Block) {
+        return Ptr - getBlockBase(Block) <= BlockSize;
+      };
+      if (Addr == 0) {
+        Poison |= Offset != 0;
+      } else {
+        bool Found = false;
+        for (uint32_t Block = 1; Block <= In.NumBlocks && !Found; ++Block)
+          if (InBlock(Addr, Block)) {
+            Found = true;
+            Poison |= !InBlock(static_cast<uint64_t>(Result), Block);
+          }
+        Poison |= !Found;
+      }
+    }
+    R.Bits[L] = static_cast<uint64_t>(Result);
+    R.Poison[L] = Poison;
+  }
+  return true;
+}
+
+// Loads and stores are modelled for whole bytes of integers and FP values.
+// A poison byte makes the whole loaded element poison.
+bool isMemoryType(Type *Ty) {
+  if (!getNumSlots(Ty) || Ty->isStructTy() || Ty->isPtrOrPtrVectorTy())
+    return false;
+  unsigned W = getWidth(Ty);
+  return W == 8 || W == 16 || W == 32 || W == 64;
+}
+
+bool Execution::evalLoad(const LoadInst &LI, Lanes &R) {
+  if (!LI.isSimple() || !isMemoryType(LI.getType()))
+    return false;
+  for (unsigned Kind : {LLVMContext::MD_range, LLVMContext::MD_nonnull,
+                        LLVMContext::MD_noundef, LLVMContext::MD_align,
+                        LLVMContext::MD_dereferenceable,
+                        LLVMContext::MD_dereferenceable_or_null})
+    if (LI.hasMetadata(Kind))
+      return false;
+  const Lanes *Ptr = get(LI.getPointerOperand());
+  if (!Ptr)
+    return false;
+  unsigned Slots = getNumSlots(LI.getType());
+  unsigned EltBytes = getWidth(LI.getType()) / 8;
+  uint64_t Align = LI.getAlign().value();
+  for (uint32_t L = 0; L != N; ++L) {
+    if (!Active[L])
+      continue;
+    auto Start =
+        Ptr->Poison[L]
+            ? std::nullopt
+            : getByteIndex(Ptr->Bits[L], Slots * EltBytes, Align, L);
+    if (!Start) {
+      setUB(L);
+      continue;
+    }
+    for (unsigned S = 0; S != Slots; ++S) {
+      uint64_t V = 0;
+      bool Poison = false;
+      for (unsigned Byte = 0; Byte != EltBytes; ++Byte) {
+        size_t Idx = *Start + (S * EltBytes + Byte) * N;
+        V |= static_cast<uint64_t>(Memory[Idx]) << (8 * Byte);
+        Poison |= MemoryPoison[Idx];
+      }
+      R.Bits[S * N + L] = V;
+      R.Poison[S * N + L] = Poison;
+    }
+  }
+  return true;
+}
+
+bool Execution::evalStore(const StoreInst &SI) {
+  Type *Ty = SI.getValueOperand()->getType();
+  if (!SI.isSimple() || !isMemoryType(Ty))
+    return false;
+  const Lanes *Ptr = get(SI.getPointerOperand());
+  const Lanes *Val = get(SI.getValueOperand());
+  if (!Ptr || !Val)
+    return false;
+  unsigned Slots = getNumSlots(Ty);
+  unsigned EltBytes = getWidth(Ty) / 8;
+  bool IsFP = Ty->isFPOrFPVectorTy();
+  bool IsDouble = Ty->getScalarType()->isDoubleTy();
+  uint64_t Align = SI.getAlign().value();
+  for (uint32_t L = 0; L != N; ++L) {
+    if (!Active[L])
+      continue;
+    auto Start =
+        Ptr->Poison[L]
+            ? std::nullopt
+            : getByteIndex(Ptr->Bits[L], Slots * EltBytes, Align, L);
+    if (!Start) {
+      setUB(L);
+      continue;
+    }
+    for (unsigned S = 0; S != Slots; ++S) {
+      uint64_t V = Val->Bits[S * N + L];
+      bool Poison = Val->Poison[S * N + L];
+      // The payload of a NaN becomes observable in memory.
+      if (IsFP && !Poison && isNaN(V, IsDouble))
+        setNondet(L);
+      for (unsigned Byte = 0; Byte != EltBytes; ++Byte) {
+        size_t Idx = *Start + (S * EltBytes + Byte) * N;
+        Memory[Idx] = static_cast<uint8_t>(V >> (8 * Byte));
+        MemoryPoison[Idx] = Poison;
+      }
+    }
+  }
+  return true;
+}
+
+void Execution::enter(const BasicBlock *Succ, const BasicBlock *From,
+                      uint32_t L) {
+  auto &Entered = EnteredFrom[Succ];
+  if (Entered.empty())
+    Entered.assign(N, nullptr);
+  Entered[L] = From;
+}
+
+bool Execution::evalTerminator(const Instruction &I) {
+  const BasicBlock *BB = I.getParent();
+  if (auto *Ret = dyn_cast<ReturnInst>(&I)) {
+    const Value *RetVal = Ret->getReturnValue();
+    const Lanes *V = RetVal ? get(RetVal) : nullptr;
+    if (RetVal && !V)
+      return false;
+    for (uint32_t L = 0; L != N; ++L) {
+      if (!Active[L])
+        continue;
+      Returned[L] = 1;
+      if (!V)
+        continue;
+      for (unsigned S = 0, Slots = getNumSlots(RetVal->getType());
+           S != Slots; ++S) {
+        Result->Bits[S * N + L] = V->Bits[S * N + L];
+        Result->Poison[S * N + L] = V->Poison[S * N + L];
+      }
+    }
+    return true;
+  }
+  if (isa<UnreachableInst>(I)) {
+    for (uint32_t L = 0; L != N; ++L)
+      setUB(L);
+    return true;
+  }
+  if (auto *Br = dyn_cast<BranchInst>(&I)) {
+    if (Br->isUnconditional()) {
+      for (uint32_t L = 0; L != N; ++L)
+        if (Active[L])
+          enter(Br->getSuccessor(0), BB, L);
+      return true;
+    }
+    const Lanes *Cond = get(Br->getCondition());
+    if (!Cond)
+      return false;
+    for (uint32_t L = 0; L != N; ++L) {
+      if (!Active[L])
+        continue;
+      if (Cond->Poison[L])
+        setUB(L);
+      else
+        enter(Br->getSuccessor(Cond->Bits[L] ? 0 : 1), BB, L);
+    }
+    return true;
+  }
+  if (auto *Switch = dyn_cast<SwitchInst>(&I)) {
+    const Lanes *Cond = get(Switch->getCondition());
+    if (!Cond)
+      return false;
+    for (uint32_t L = 0; L != N; ++L) {
+      if (!Active[L])
+        continue;
+      if (Cond->Poison[L]) {
+        setUB(L);
+        continue;
+      }
+      const BasicBlock *Dest = Switch->getDefaultDest();
+      for (auto &Case : Switch->cases())
+        if (Case.getCaseValue()->getZExtValue() == Cond->Bits[L]) {
+          Dest = Case.getCaseSuccessor();
+          break;
+        }
+      enter(Dest, BB, L);
+    }
+    return true;
+  }
+  return false;
+}
+
+bool Execution::eval(const Instruction &I,
+                     const std::vector<const BasicBlock *> &From) {
+  if (I.isTerminator())
+    return evalTerminator(I);
+  if (auto *SI = dyn_cast<StoreInst>(&I))
+    return evalStore(*SI);
+
+  Type *Ty = I.getType();
+  unsigned Slots = getNumSlots(Ty);
+  if (!Slots && !(Ty->isVoidTy() && isa<IntrinsicInst>(I)))
+    return false;
+  for (const Use &Op : I.operands())
+    if (!isa<BasicBlock>(Op) && !isa<Function>(Op) &&
+        !getNumSlots(Op->getType()))
+      return false;
+  Lanes &R = define(I, Slots);
+
+  bool Supported;
+  if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
+    Supported = Ty->isIntOrIntVectorTy() ? evalIntBinOp(*BinOp, R)
+                                         : evalFPBinOp(I, R);
+  } else if (I.getOpcode() == Instruction::FNeg) {
+    Supported = evalFPBinOp(I, R);
+  } else if (auto *Cast = dyn_cast<CastInst>(&I)) {
+    Supported = evalCast(*Cast, R);
+  } else if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+    Supported = evalCmp(*Cmp, R);
+  } else if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+    Supported = evalIntrinsic(*II, R);
+  } else if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+    Supported = evalGEP(*GEP, R);
+  } else if (auto *LI = dyn_cast<LoadInst>(&I)) {
+    Supported = evalLoad(*LI, R);
+  } else if (auto *Sel = dyn_cast<SelectInst>(&I)) {
+    const Lanes *Cond = get(Sel->getCondition());
+    const Lanes *T = get(Sel->getTrueValue());
+    const Lanes *F = get(Sel->getFalseValue());
+    Supported = Cond && T && F;
+    bool VectorCond = Sel->getCondition()->getType()->isVectorTy();
+    for (unsigned S = 0; Supported && S != Slots; ++S)
+      for (uint32_t L = 0; L != N; ++L) {
+        size_t Idx = S * N + L;
+        size_t CondIdx = VectorCond ? Idx : L;
+        const Lanes *Chosen = Cond->Bits[CondIdx] ? T : F;
+        R.Bits[Idx] = Chosen->Bits[Idx];
+        R.Poison[Idx] = Cond->Poison[CondIdx] || Chosen->Poison[Idx];
+      }
+  } else if (auto *Freeze = dyn_cast<FreezeInst>(&I)) {
+    // tgt may pick any value; zero is as good as another. src would have to
+    // be enumerated.
+    const Lanes *V = get(Freeze->getOperand(0));
+    Supported = V;
+    for (size_t Idx = 0; Supported && Idx != Slots * N; ++Idx) {
+      R.Bits[Idx] = V->Poison[Idx] ? 0 : V->Bits[Idx];
+      if (V->Poison[Idx])
+        setNondet(Idx % N);
+    }
+  } else if (auto *Phi = dyn_cast<PHINode>(&I)) {
+    Supported = true;
+    for (unsigned Incoming = 0;
+         Supported && Incoming != Phi->getNumIncomingValues(); ++Incoming) {
+      const BasicBlock *Pred = Phi->getIncomingBlock(Incoming);
+      if (std::find(From.begin(), From.end(), Pred) == From.end())
+        continue;
+      const Lanes *V = get(Phi->getIncomingValue(Incoming));
+      Supported = V;
+      for (uint32_t L = 0; Supported && L != N; ++L) {
+        if (From[L] != Pred)
+          continue;
+        for (unsigned S = 0; S != Slots; ++S) {
+          R.Bits[S * N + L] = V->Bits[S * N + L];
+          R.Poison[S * N + L] = V->Poison[S * N + L];
+        }
+      }
+    }
+  } else if (auto *Extract = dyn_cast<ExtractElementInst>(&I)) {
+    const Lanes *Vec = get(Extract->getVectorOperand());
+    const Lanes *Index = get(Extract->getIndexOperand());
+    unsigned NumElts = getNumSlots(Extract->getVectorOperandType());
+    Supported = Vec && Index;
+    for (uint32_t L = 0; Supported && L != N; ++L) {
+      uint64_t Elt = Index->Bits[L];
+      if (Index->Poison[L] || Elt >= NumElts) {
+        R.Poison[L] = 1;
+        continue;
+      }
+      R.Bits[L] = Vec->Bits[Elt * N + L];
+      R.Poison[L] = Vec->Poison[Elt * N + L];
+    }
+  } else if (auto *Insert = dyn_cast<InsertElementInst>(&I)) {
+    const Lanes *Vec = get(Insert->getOperand(0));
+    const Lanes *Elt = get(Insert->getOperand(1));
+    const Lanes *Index = get(Insert->getOperand(2));
+    Supported = Vec && Elt && Index;
+    for (uint32_t L = 0; Supported && L != N; ++L) {
+      uint64_t Pos = Index->Bits[L];
+      bool Poison = Index->Poison[L] || Pos >= Slots;
+      for (unsigned S = 0; S != Slots; ++S) {
+        size_t Idx = S * N + L;
+        bool IsElt = S == Pos;
+        R.Bits[Idx] = IsElt ? Elt->Bits[L] : Vec->Bits[Idx];
+        R.Poison[Idx] = Poison || (IsElt ? Elt->Poison[L] : Vec->Poison[Idx]);
+      }
+    }
+  } else if (auto *Shuffle = dyn_cast<ShuffleVectorInst>(&I)) {
+    const Lanes *A = get(Shuffle->getOperand(0));
+    const Lanes *B = get(Shuffle->getOperand(1));
+    unsigned NumElts = getNumSlots(Shuffle->getOperand(0)->getType());
+    Supported = A && B;
+    for (unsigned S = 0; Supported && S != Slots; ++S) {
+      int MaskElt = Shuffle->getMaskValue(S);
+      for (uint32_t L = 0; L != N; ++L) {
+        size_t Idx = S * N + L;
+        if (MaskElt < 0) {
+          R.Poison[Idx] = 1;
+          continue;
+        }
+        unsigned Elt = static_cast<unsigned>(MaskElt);
+        const Lanes *Vec = Elt < NumElts ? A : B;
+        size_t SrcIdx = (Elt % NumElts) * N + L;
+        R.Bits[Idx] = Vec->Bits[SrcIdx];
+        R.Poison[Idx] = Vec->Poison[SrcIdx];
+      }
+    }
+  } else if (auto *Extract = dyn_cast<ExtractValueInst>(&I)) {
+    const Lanes *Agg = get(Extract->getAggregateOperand());
+    Supported = Agg && Extract->getNumIndices() == 1;
+    unsigned First = 0;
+    auto *StructTy = cast<StructType>(Extract->getAggregateOperand()->getType());
+    for (unsigned Elt = 0; Supported && Elt != Extract->getIndices()[0]; ++Elt)
+      First += getNumSlots(StructTy->getElementType(Elt));
+    for (size_t Idx = 0; Supported && Idx != Slots * N; ++Idx) {
+      R.Bits[Idx] = Agg->Bits[First * N + Idx];
+      R.Poison[Idx] = Agg->Poison[First * N + Idx];
+    }
+  } else {
+    Supported = false;
+  }
+  return Supported && applyFMF(I, R);
+}
+
+bool Execution::run() {
+  Type *RetTy = F.getReturnType();
+  if (!DL.isLittleEndian() || RetTy->isStructTy() ||
+      (!RetTy->isVoidTy() && !getNumSlots(RetTy)))
+    return false;
+  for (StringRef Attr : {"denormal-fp-math", "denormal-fp-math-f32"})
+    if (F.hasFnAttribute(Attr) &&
+        F.getFnAttribute(Attr).getValueAsString() != "ieee,ieee")
+      return false;
+  if (!RetTy->isVoidTy())
+    Result = std::make_unique<Lanes>(getNumSlots(RetTy) * N);
+
+  ReversePostOrderTraversal<const Function *> RPOT(&F);
+  DenseMap<const BasicBlock *, unsigned> Order;
+  for (const BasicBlock *BB : RPOT) {
+    unsigned Index = Order.size();
+    Order[BB] = Index;
+  }
+  for (const BasicBlock *BB : RPOT)
+    for (const BasicBlock *Succ : successors(BB))
+      if (Order.lookup(Succ) <= Order.lookup(BB))
+        return false;
+
+  const BasicBlock *Entry = &F.getEntryBlock();
+  EnteredFrom[Entry].assign(N, Entry);
+  for (const BasicBlock *BB : RPOT) {
+    std::vector<const BasicBlock *> From = EnteredFrom.lookup(BB);
+    if (From.empty())
+      From.assign(N, nullptr);
+    for (uint32_t L = 0; L != N; ++L)
+      Active[L] = From[L] && !UB[L];
+    for (const Instruction &I : *BB)
+      if (!eval(I, From))
+        return false;
+  }
+
+  for (uint32_t L = 0; L != N; ++L)
+    Active[L] = Returned[L] && !UB[L];
+  if (Result)
+    return applyRetAttrs(F.getAttributes().getRetAttrs(), RetTy, *Result);
+  return true;
+}
+
+bool accessesMemory(const Function &F) {
+  for (const BasicBlock &BB : F)
+    for (const Instruction &I : BB)
+      if (I.mayReadOrWriteMemory() && !isa<IntrinsicInst>(I))
+        return true;
+  return false;
+}
+} // namespace
+
+ScreenResult screenRefinement(const Function &Src, const Function &Tgt,
+                              uint32_t NumInputs) {
+  if (!NumInputs || Src.getFunctionType() != Tgt.getFunctionType())
+    return ScreenResult::Unsupported;
+  for (const Function *F : {&Src, &Tgt})
+    if (accessesMemory(*F) &&
+        F->getMemoryEffects() != MemoryEffects::unknown())
+      return ScreenResult::Unsupported;
+
+  Inputs In;
+  In.N = NumInputs;
+  if (!generateInputs(Src, Tgt, In))
+    return ScreenResult::Unsupported;
+
+  Execution SrcExec(Src, In, /*IsSrc=*/true);
+  Execution TgtExec(Tgt, In, /*IsSrc=*/false);
+  if (!SrcExec.run() || !TgtExec.run())
+    return ScreenResult::Unsupported;
+
+  Type *RetTy = Src.getReturnType();
+  unsigned Slots = RetTy->isVoidTy() ? 0 : getNumSlots(RetTy);
+  bool IsFP = RetTy->isFPOrFPVectorTy();
+  bool IsDouble = RetTy->getScalarType()->isDoubleTy();
+  const uint32_t N = NumInputs;
+  for (uint32_t L = 0; L != N; ++L) {
+    if (In.Skip[L] || SrcExec.UB[L] || SrcExec.Nondet[L] ||
+        !SrcExec.Returned[L])
+      continue;
+    if (TgtExec.UB[L] || !TgtExec.Returned[L])
+      return ScreenResult::Mismatch;
+    for (unsigned S = 0; S != Slots; ++S) {
+      size_t Idx = S * N + L;
+      if (SrcExec.Result->Poison[Idx])
+        continue;
+      if (TgtExec.Result->Poison[Idx])
+        return ScreenResult::Mismatch;
+      uint64_t X = SrcExec.Result->Bits[Idx], Y = TgtExec.Result->Bits[Idx];
+      if (X != Y && !(IsFP && isNaN(X, IsDouble) && isNaN(Y, IsDouble)))
+        return ScreenResult::Mismatch;
+    }
+    for (size_t Idx = L; Idx < SrcExec.Memory.size(); Idx += N) {
+      if (SrcExec.MemoryPoison[Idx])
+        continue;
+      if (TgtExec.MemoryPoison[Idx] ||
+          SrcExec.Memory[Idx] != TgtExec.Memory[Idx])
+        return ScreenResult::Mismatch;
+    }
+  }
+  return ScreenResult::Consistent;
+}
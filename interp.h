@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+
+#include <cstdint>
+
+namespace llvm {
+class Function;
+} // namespace llvm
+
+enum class ScreenResult {
+  // Src or Tgt uses something the interpreter does not model.
+  Unsupported,
+  // Tgt refined Src on every input.
+  Consistent,
+  // Some input shows that Tgt does not refine Src.
+  Mismatch
+};
+
+// Runs Src and Tgt on NumInputs concrete inputs and checks that the result of
+// Tgt refines the one of Src on each of them: inputs on which Src has
+// undefined behavior or returns poison are skipped, and on the others Tgt must
+// return the same value without undefined behavior. All inputs are evaluated
+// at once, with values stored as structure-of-arrays lanes.
+//
+// The interpreter covers loop-free functions over integers of up to 64 bits,
+// float, double, pointers and fixed vectors of them, with poison-generating
+// flags and the integer and FP intrinsics that merge keeps.
+//
+// Memory is modelled for pointer arguments only: each points to the start of
+// a 256-byte block of its own, so arguments never alias, and the blocks start
+// out with the same random bytes for src and tgt. Simple loads and stores of
+// 8- to 64-bit integer and FP elements at scalar GEPs into a block are
+// executed, and an access outside its block or below its alignment is
+// undefined behavior. On top of the returned value, Tgt must leave every byte
+// Src defines with the same value.
+//
+// The screen bails out on calls, allocas, globals, atomic or volatile
+// accesses, loads and stores of pointers or aggregates, load metadata, memory
+// attributes on a function or a pointer argument (e.g. readonly,
+// dereferenceable beyond a block) and fast-math flags other than nnan and
+// ninf. So a mismatch is a real miscompile while a consistent result proves
+// nothing.
+ScreenResult screenRefinement(const llvm::Function &Src,
+                              const llvm::Function &Tgt, uint32_t NumInputs);
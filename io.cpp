@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "io.h"
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <optional>
+
+using namespace llvm;
+
+bool writeModule(const Module &M, StringRef Path, bool Bitcode) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, Bitcode ? sys::fs::OF_None : sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Error opening file: " << EC.message() << '\n';
+    return false;
+  }
+  if (Bitcode)
+    WriteBitcodeToFile(M, OS);
+  else
+    M.print(OS, nullptr);
+  return true;
+}
+
+bool writeJournal(const MutationJournal &Journal, StringRef Path,
+                  const JournalSample &Sample) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Error opening file: " << EC.message() << '\n';
+    return false;
+  }
+  json::Array Edits;
+  for (auto &Edit : Journal)
+    Edits.push_back(json::Object{{"function", Edit.Function},
+                                 {"site", Edit.Site},
+                                 {"mutator", Edit.Mutator},
+                                 {"seed", Edit.Seed}});
+  json::Object Root{{"edits", std::move(Edits)}};
+  if (Sample.Count) {
+    Root["sample"] = Sample.Count;
+    Root["sample-seed"] = Sample.Seed;
+  }
+  OS << json::Value(std::move(Root)) << '\n';
+  return true;
+}
+
+Expected<MutationJournal> readJournal(StringRef Path, JournalSample *Sample) {
+  auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/true);
+  if (!Buffer)
+    return createFileError(Path, Buffer.getError());
+  auto Root = json::parse((*Buffer)->getBuffer());
+  if (!Root)
+    return Root.takeError();
+
+  auto Invalid = [&] {
+    return createStringError(inconvertibleErrorCode(),
+                             "invalid journal " + Path);
+  };
+  auto *Obj = Root->getAsObject();
+  auto *Edits = Obj ? Obj->getArray("edits") : nullptr;
+  if (!Edits)
+    return Invalid();
+
+  if (Sample) {
+    *Sample = {};
+    if (auto *Count = Obj->get("sample")) {
+      auto CountValue = Count->getAsUINT64();
+      auto *Seed = Obj->get("sample-seed");
+      auto SeedValue = Seed ? Seed->getAsUINT64() : std::nullopt;
+      if (!CountValue || !SeedValue)
+        return Invalid();
+      *Sample = {static_cast<uint32_t>(*CountValue), *SeedValue};
+    }
+  }
+
+  MutationJournal Journal;
+  for (auto &Value : *Edits) {
+    auto *Edit = Value.getAsObject();
+    if (!Edit)
+      return Invalid();
+    auto Function = Edit->getString("function");
+    auto Site = Edit->getInteger("site");
+    auto Mutator = Edit->getString("mutator");
+    auto *Seed = Edit->get("seed");
+    auto SeedValue = Seed ? Seed->getAsUINT64() : std::nullopt;
+    if (!Function || !Site || !Mutator || !SeedValue)
+      return Invalid();
+    Journal.push_back({Function->str(), static_cast<uint32_t>(*Site),
+                       Mutator->str(), *SeedValue});
+  }
+  return Journal;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+
+#include "mutator.h"
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+// Writes M to Path, as bitcode if Bitcode is set and as textual IR otherwise.
+// Reading needs no counterpart: parseIRFile accepts both formats.
+bool writeModule(const llvm::Module &M, llvm::StringRef Path, bool Bitcode);
+
+// The functions of the seed a mutant is made of with mutate --sample: Count
+// functions picked with sampleIndices and Seed (0 = all of them).
+struct JournalSample {
+  uint32_t Count = 0;
+  uint64_t Seed = 0;
+};
+
+// Journals are stored as JSON:
+//   {"edits": [{"function": "f", "site": 3, "mutator": "opcode",
+//               "seed": 42}, ...],
+//    "sample": 16, "sample-seed": 7}
+// where the sample fields are only present for a mutant of a sample.
+bool writeJournal(const MutationJournal &Journal, llvm::StringRef Path,
+                  const JournalSample &Sample = {});
+llvm::Expected<MutationJournal> readJournal(llvm::StringRef Path,
+                                            JournalSample *Sample = nullptr);
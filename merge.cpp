@@ -3,14 +3,23 @@
 // This file is licensed under the Apache-2.0 License.
 // See the LICENSE file for more information.
 
+#include "fingerprint.h"
+#include "io.h"
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/APInt.h>
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/Analysis/InstructionSimplify.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/Argument.h>
 #include <llvm/IR/AttributeMask.h>
 #include <llvm/IR/Attributes.h>
@@ -24,6 +33,7 @@
 #include <llvm/IR/GlobalValue.h>
 #include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Instruction.h>
@@ -35,6 +45,7 @@
 #include <llvm/IR/Operator.h>
 #include <llvm/IR/PassInstrumentation.h>
 #include <llvm/IR/PatternMatch.h>
+#include <llvm/IR/StructuralHash.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
@@ -45,28 +56,107 @@
 #include <llvm/Support/Error.h>
 #include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/FormattedStream.h>
 #include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/LineIterator.h>
+#include <llvm/Support/MathExtras.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/xxhash.h>
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <chrono>
 #include <cstdlib>
 #include <filesystem>
+#include <optional>
+#include <queue>
 #include <string>
+#include <tuple>
+#include <vector>
 
 using namespace llvm;
 using namespace PatternMatch;
 namespace fs = std::filesystem;
 
-static cl::opt<std::string> SeedsDir(cl::Positional, cl::desc("<seeds dir>"),
-                                     cl::Required,
-                                     cl::value_desc("path to seeds"));
-static cl::opt<std::string> OutputFile(cl::Positional,
-                                       cl::desc("<output file>"), cl::Required,
-                                       cl::value_desc("path to seed file"));
+static cl::list<std::string>
+    Inputs(cl::Positional, cl::desc("<seed files or dirs>"), cl::ZeroOrMore,
+           cl::value_desc("seed files, or dirs searched recursively"));
+static cl::opt<std::string>
+    OutputFile(cl::Positional, cl::desc("<output>"), cl::Required,
+               cl::value_desc("seed file, or dir with --per-seed"));
+static cl::opt<std::string> Manifest(
+    "manifest",
+    cl::desc("File of '<test file>\t<function>' lines. Each test file is "
+             "parsed once, and only the listed functions are kept as seeds, "
+             "like llvm-extract -func does"),
+    cl::value_desc("path"));
+static cl::opt<bool>
+    PerSeed("per-seed",
+            cl::desc("Write a batch of each seed file to <output>/<name>, "
+                     "instead of one batch of all of them"),
+            cl::init(false));
+static cl::opt<std::string>
+    CacheDir("cache",
+             cl::desc("Dir that filtered seeds are stored in and reused from "
+                      "across runs"),
+             cl::value_desc("path"));
+static cl::opt<bool>
+    CacheOnly("cache-only",
+              cl::desc("Only filter the seeds into --cache, e.g. to prewarm "
+                       "it for later runs. Nothing is linked, and <output> "
+                       "is not written"),
+              cl::init(false));
+static cl::opt<std::string>
+    CacheTag("cache-tag",
+             cl::desc("Revision of LLVM, and of any patch applied to it. "
+                      "Cached seeds are only reused with the same tag"),
+             cl::init(""));
+static cl::opt<uint32_t> Jobs("j",
+                              cl::desc("Number of threads (0 = all cores)"),
+                              cl::init(0));
 static cl::opt<bool> IgnoreFP("ignore-fp", cl::desc("Ignore FP ops"),
                               cl::init(false));
+static cl::opt<bool> EmitBitcode("emit-bc",
+                                 cl::desc("Write bitcode instead of textual IR"),
+                                 cl::init(false));
+static cl::opt<bool>
+    Distill("distill",
+            cl::desc("Keep one function of each shape across all seeds, where "
+                     "functions that only differ in bit widths, constants or "
+                     "the order of commutative operands have the same shape. "
+                     "Scalars and vectors of different lengths do not"),
+            cl::init(false));
+static cl::opt<uint32_t> DistillBudget(
+    "distill-budget",
+    cl::desc("With --distill, keep at most N functions, chosen to cover as "
+             "many opcodes, predicates and intrinsics as possible (0 = no "
+             "limit)"),
+    cl::init(0));
+static cl::opt<bool>
+    WriteIndex("index",
+               cl::desc("Also write <output>.index.json, listing the name, "
+                        "position, instruction count, opcode histogram and "
+                        "hash of each function of the batch"),
+               cl::init(false));
+static cl::opt<bool>
+    PrintTiming("print-timing",
+                cl::desc("Print the time spent in each stage to stderr"),
+                cl::init(false));
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t getElapsedMs(Clock::time_point Start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                               Start)
+      .count();
+}
+
 static bool isValidType(Type *Ty) {
   if (Ty->isScalableTy())
     return false;
@@ -99,243 +189,882 @@ static bool hasUnsupportedType(Instruction &I) {
   return false;
 }
 
-int main(int argc, char **argv) {
-  InitLLVM Init{argc, argv};
-  cl::ParseCommandLineOptions(argc, argv, "merge\n");
-
-  LLVMContext Ctx;
-  SMDiagnostic Err;
-  Module OutM("", Ctx);
-  uint64_t BatchSize = 128;
-  uint64_t IterCount = 0;
-
-  while (OutM.size() < BatchSize) {
-    for (auto &Seed : fs::directory_iterator(SeedsDir.c_str())) {
-      DenseSet<StringRef> Symbols;
-      for (auto &GV : OutM.globals())
-        Symbols.insert(GV.getName());
-      for (auto &F : OutM.functions())
-        Symbols.insert(F.getName());
-
-      std::unique_ptr<Module> M = parseIRFile(Seed.path().c_str(), Err, Ctx);
-      if (!M) {
-        Err.print(argv[0], errs());
-        return EXIT_FAILURE;
-      }
-
-      SmallPtrSet<GlobalValue *, 16> ErasedGlobals;
-      for (auto &Alias : M->aliases()) {
-        ErasedGlobals.insert(&Alias);
-      }
+// Drops the functions and globals of a seed that alive2 or the mutator cannot
+// handle, and rewrites the rest into the subset they support. Returns the
+// number of function definitions left.
+static uint32_t filterSeed(Module &M) {
+  SmallPtrSet<GlobalValue *, 16> ErasedGlobals;
+  for (auto &Alias : M.aliases()) {
+    ErasedGlobals.insert(&Alias);
+  }
 
-      for (auto &GV : M->globals()) {
-        StringRef Name = GV.getName();
-        uint32_t Id = 0;
-        if (Symbols.count(Name)) {
-          do {
-            GV.setName(Name + std::to_string(++Id));
-          } while (Symbols.count(GV.getName()));
-        }
+  for (auto &GV : M.globals()) {
+    if (GV.getAddressSpace() != 0 || !isValidType(GV.getValueType())) {
+      ErasedGlobals.insert(&GV);
+    }
+  }
 
-        if (GV.getAddressSpace() != 0 || !isValidType(GV.getValueType())) {
-          ErasedGlobals.insert(&GV);
-        }
-      }
+  for (auto &F : M) {
+    if (F.empty())
+      continue;
 
-      for (auto &F : *M) {
-        if (F.empty())
-          continue;
+    DominatorTree DT(F);
+    if (!isValidType(F.getReturnType()) ||
+        (!F.arg_empty() && !all_of(F.args(), [](Argument &Arg) {
+          return isValidType(Arg.getType());
+        }))) {
+      ErasedGlobals.insert(&F);
+      continue;
+    }
 
-        StringRef Name = F.getName();
-        uint32_t Id = 0;
-        if (Symbols.count(Name)) {
-          do {
-            F.setName(Name + std::to_string(++Id));
-          } while (Symbols.count(F.getName()));
-        }
+    for (auto &Arg : F.args()) {
+      Arg.removeAttr(Attribute::NoAlias);
+      Arg.removeAttr(Attribute::StructRet);
+      Arg.removeAttr(Attribute::SwiftError);
+    }
 
-        DominatorTree DT(F);
-        if (!isValidType(F.getReturnType()) ||
-            (!F.arg_empty() && !all_of(F.args(), [](Argument &Arg) {
-              return isValidType(Arg.getType());
-            }))) {
+    for (auto &BB : F) {
+      for (auto &I : make_early_inc_range(BB)) {
+        I.dropUnknownNonDebugMetadata({Attribute::NoUndef,
+                                       Attribute::Dereferenceable,
+                                       Attribute::Range});
+        if (hasUnsupportedType(I) ||
+            I.getOpcode() == Instruction::IntToPtr ||
+            isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I) ||
+            isa<AllocaInst>(I)) {
           ErasedGlobals.insert(&F);
+          break;
+        }
+        if (auto *Load = dyn_cast<LoadInst>(&I)) {
+          if (!Load->isSimple()) {
+            ErasedGlobals.insert(&F);
+            break;
+          }
+        }
+        if (auto *Store = dyn_cast<StoreInst>(&I)) {
+          if (!Store->isSimple()) {
+            ErasedGlobals.insert(&F);
+            break;
+          }
+        }
+        if (I.isDebugOrPseudoInst()) {
+          I.eraseFromParent();
           continue;
         }
-
-        for (auto &Arg : F.args()) {
-          Arg.removeAttr(Attribute::NoAlias);
-          Arg.removeAttr(Attribute::StructRet);
-          Arg.removeAttr(Attribute::SwiftError);
+        if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+          if (!isValidType(GEP->getSourceElementType())) {
+            ErasedGlobals.insert(&F);
+            break;
+          }
         }
+        if (auto *Call = dyn_cast<CallBase>(&I)) {
+          // FIXME: Alive2 do not respect call-site attrs.
+          AttributeMask AttrsToRemove;
+          AttrsToRemove.addAttribute(Attribute::NoUndef);
+          AttrsToRemove.addAttribute(Attribute::NonNull);
+          AttrsToRemove.addAttribute(Attribute::Range);
+          AttrsToRemove.addAttribute(Attribute::Alignment);
+          AttrsToRemove.addAttribute(Attribute::Dereferenceable);
+          AttrsToRemove.addAttribute(Attribute::DereferenceableOrNull);
+          AttrsToRemove.addAttribute(Attribute::NoFPClass);
+          for (auto &Arg : Call->args())
+            Call->removeParamAttrs(Call->getArgOperandNo(&Arg),
+                                   AttrsToRemove);
 
-        for (auto &BB : F) {
-          for (auto &I : make_early_inc_range(BB)) {
-            I.dropUnknownNonDebugMetadata({Attribute::NoUndef,
-                                           Attribute::Dereferenceable,
-                                           Attribute::Range});
-            if (hasUnsupportedType(I) ||
-                I.getOpcode() == Instruction::IntToPtr ||
-                isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I) ||
-                isa<AllocaInst>(I)) {
-              ErasedGlobals.insert(&F);
+          bool Known = false;
+          if (auto *II = dyn_cast<IntrinsicInst>(Call)) {
+            switch (II->getIntrinsicID()) {
+            case Intrinsic::umax:
+            case Intrinsic::umin:
+            case Intrinsic::smax:
+            case Intrinsic::smin:
+            case Intrinsic::abs:
+            case Intrinsic::ctlz:
+            case Intrinsic::cttz:
+            case Intrinsic::ctpop:
+            case Intrinsic::sadd_sat:
+            case Intrinsic::ssub_sat:
+            case Intrinsic::sshl_sat:
+            case Intrinsic::uadd_sat:
+            case Intrinsic::usub_sat:
+            case Intrinsic::ushl_sat:
+            case Intrinsic::sadd_with_overflow:
+            case Intrinsic::ssub_with_overflow:
+            case Intrinsic::smul_with_overflow:
+            case Intrinsic::uadd_with_overflow:
+            case Intrinsic::usub_with_overflow:
+            case Intrinsic::umul_with_overflow:
+            case Intrinsic::fshl:
+            case Intrinsic::fshr:
+            case Intrinsic::bitreverse:
+            case Intrinsic::bswap:
+            case Intrinsic::fabs:
+            case Intrinsic::copysign:
+            case Intrinsic::is_fpclass:
+            case Intrinsic::fma:
+            case Intrinsic::fmuladd:
+            case Intrinsic::maximum:
+            case Intrinsic::maximumnum:
+            case Intrinsic::maxnum:
+            case Intrinsic::minimum:
+            case Intrinsic::minimumnum:
+            case Intrinsic::minnum:
+            case Intrinsic::canonicalize:
+              Known = true;
+            case Intrinsic::assume:
+              Known = !II->hasOperandBundles();
+            default:
               break;
             }
-            if (auto *Load = dyn_cast<LoadInst>(&I)) {
-              if (!Load->isSimple()) {
-                ErasedGlobals.insert(&F);
-                break;
-              }
-            }
-            if (auto *Store = dyn_cast<StoreInst>(&I)) {
-              if (!Store->isSimple()) {
-                ErasedGlobals.insert(&F);
-                break;
-              }
-            }
-            if (I.isDebugOrPseudoInst()) {
-              I.eraseFromParent();
-              continue;
-            }
-            if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
-              if (!isValidType(GEP->getSourceElementType())) {
-                ErasedGlobals.insert(&F);
-                break;
-              }
-            }
-            if (auto *Call = dyn_cast<CallBase>(&I)) {
-              // FIXME: Alive2 do not respect call-site attrs.
-              AttributeMask AttrsToRemove;
-              AttrsToRemove.addAttribute(Attribute::NoUndef);
-              AttrsToRemove.addAttribute(Attribute::NonNull);
-              AttrsToRemove.addAttribute(Attribute::Range);
-              AttrsToRemove.addAttribute(Attribute::Alignment);
-              AttrsToRemove.addAttribute(Attribute::Dereferenceable);
-              AttrsToRemove.addAttribute(Attribute::DereferenceableOrNull);
-              AttrsToRemove.addAttribute(Attribute::NoFPClass);
-              for (auto &Arg : Call->args())
-                Call->removeParamAttrs(Call->getArgOperandNo(&Arg),
-                                       AttrsToRemove);
-
-              bool Known = false;
-              if (auto *II = dyn_cast<IntrinsicInst>(Call)) {
-                switch (II->getIntrinsicID()) {
-                case Intrinsic::umax:
-                case Intrinsic::umin:
-                case Intrinsic::smax:
-                case Intrinsic::smin:
-                case Intrinsic::abs:
-                case Intrinsic::ctlz:
-                case Intrinsic::cttz:
-                case Intrinsic::ctpop:
-                case Intrinsic::sadd_sat:
-                case Intrinsic::ssub_sat:
-                case Intrinsic::sshl_sat:
-                case Intrinsic::uadd_sat:
-                case Intrinsic::usub_sat:
-                case Intrinsic::ushl_sat:
-                case Intrinsic::sadd_with_overflow:
-                case Intrinsic::ssub_with_overflow:
-                case Intrinsic::smul_with_overflow:
-                case Intrinsic::uadd_with_overflow:
-                case Intrinsic::usub_with_overflow:
-                case Intrinsic::umul_with_overflow:
-                case Intrinsic::fshl:
-                case Intrinsic::fshr:
-                case Intrinsic::bitreverse:
-                case Intrinsic::bswap:
-                case Intrinsic::fabs:
-                case Intrinsic::copysign:
-                case Intrinsic::is_fpclass:
-                case Intrinsic::fma:
-                case Intrinsic::fmuladd:
-                case Intrinsic::maximum:
-                case Intrinsic::maximumnum:
-                case Intrinsic::maxnum:
-                case Intrinsic::minimum:
-                case Intrinsic::minimumnum:
-                case Intrinsic::minnum:
-                case Intrinsic::canonicalize:
-                  Known = true;
-                case Intrinsic::assume:
-                  Known = !II->hasOperandBundles();
-                default:
-                  break;
-                }
-              }
-              if (!Known) {
-                ErasedGlobals.insert(&F);
-                break;
-              }
-            }
-            if (auto *Sel = dyn_cast<SelectInst>(&I)) {
-              if (Sel->getTrueValue()->getType()->isAggregateType()) {
-                ErasedGlobals.insert(&F);
-                break;
-              }
-            }
-            if (auto *FPOp = dyn_cast<FPMathOperator>(&I)) {
-              if (IgnoreFP) {
-                ErasedGlobals.insert(&F);
-                break;
-              }
-              I.setHasAllowContract(false);
-              I.setHasAllowReassoc(false);
-              I.setHasAllowReciprocal(false);
-              I.setHasApproxFunc(false);
-              // FIXME
-              I.setHasNoSignedZeros(false);
-            }
-            for (auto &U : I.operands()) {
-              Constant *C;
-              if (isa<ConstantExpr>(U) ||
-                  (isa<UndefValue>(U) && !isa<PoisonValue>(U))) {
-                U.set(Constant::getNullValue(U->getType()));
-              } else if (match(U.get(), m_Constant(C)) &&
-                         !isa<PoisonValue>(C) &&
-                         C->containsUndefOrPoisonElement()) {
-                Constant *ReplaceC =
-                    Constant::getNullValue(C->getType()->getScalarType());
-                U.set(Constant::replaceUndefsWith(C, ReplaceC));
-              }
-            }
           }
-
-          for (auto Succ : successors(&BB)) {
-            if (DT.dominates(Succ, &BB)) {
-              ErasedGlobals.insert(&F);
-              break;
-            }
+          if (!Known) {
+            ErasedGlobals.insert(&F);
+            break;
           }
-          if (ErasedGlobals.contains(&F))
+        }
+        if (auto *Sel = dyn_cast<SelectInst>(&I)) {
+          if (Sel->getTrueValue()->getType()->isAggregateType()) {
+            ErasedGlobals.insert(&F);
             break;
+          }
+        }
+        if (auto *FPOp = dyn_cast<FPMathOperator>(&I)) {
+          if (IgnoreFP) {
+            ErasedGlobals.insert(&F);
+            break;
+          }
+          I.setHasAllowContract(false);
+          I.setHasAllowReassoc(false);
+          I.setHasAllowReciprocal(false);
+          I.setHasApproxFunc(false);
+          // FIXME
+          I.setHasNoSignedZeros(false);
+        }
+        for (auto &U : I.operands()) {
+          Constant *C;
+          if (isa<ConstantExpr>(U) ||
+              (isa<UndefValue>(U) && !isa<PoisonValue>(U))) {
+            U.set(Constant::getNullValue(U->getType()));
+          } else if (match(U.get(), m_Constant(C)) &&
+                     !isa<PoisonValue>(C) &&
+                     C->containsUndefOrPoisonElement()) {
+            Constant *ReplaceC =
+                Constant::getNullValue(C->getType()->getScalarType());
+            U.set(Constant::replaceUndefsWith(C, ReplaceC));
+          }
         }
-      }
-      for (auto *F : ErasedGlobals) {
-        F->replaceAllUsesWith(PoisonValue::get(F->getType()));
-        F->eraseFromParent();
       }
 
-      Linker::linkModules(OutM, std::move(M));
+      for (auto Succ : successors(&BB)) {
+        if (DT.dominates(Succ, &BB)) {
+          ErasedGlobals.insert(&F);
+          break;
+        }
+      }
+      if (ErasedGlobals.contains(&F))
+        break;
     }
+  }
+  for (auto *F : ErasedGlobals) {
+    F->replaceAllUsesWith(PoisonValue::get(F->getType()));
+    F->eraseFromParent();
+  }
 
-    if (OutM.empty() || ++IterCount > BatchSize) {
-      errs() << "No valid functions found in " << SeedsDir << '\n';
-      return EXIT_FAILURE;
+  uint32_t Defined = 0;
+  for (auto &F : M)
+    Defined += !F.empty();
+  return Defined;
+}
+
+// The names taken in the batch module. A taken name is replaced with the
+// first free '<name><n>'. The search resumes from the last n given out for the
+// name, so the k-th copy of a seed does not probe k names per symbol.
+class SymbolTable {
+  StringSet<> Taken;
+  StringMap<uint32_t> LastId;
+
+public:
+  void add(StringRef Name) { Taken.insert(Name); }
+
+  void claim(GlobalValue &GV) {
+    if (!GV.hasName())
+      return;
+    if (Taken.contains(GV.getName())) {
+      std::string Base = GV.getName().str();
+      uint32_t &Id = LastId[Base];
+      std::string Name;
+      do {
+        Name = Base + std::to_string(++Id);
+      } while (Taken.contains(Name));
+      GV.setName(Name);
     }
+    Taken.insert(GV.getName());
   }
+};
 
-  // TODO: set datalayout for pointer width
-  if (verifyModule(OutM, &errs()))
-    return EXIT_FAILURE;
+static constexpr uint64_t BatchSize = 128;
 
+// Fills a module with copies of Seeds, all of them at a time, until it has
+// BatchSize functions. Returns null if they do not link.
+static std::unique_ptr<Module>
+buildBatch(LLVMContext &Ctx, ArrayRef<std::unique_ptr<Module>> Seeds) {
+  auto OutM = std::make_unique<Module>("", Ctx);
+  SymbolTable Symbols;
+  while (OutM->size() < BatchSize) {
+    for (auto &Seed : Seeds) {
+      std::unique_ptr<Module> M = CloneModule(*Seed);
+      for (auto &GV : M->globals())
+        Symbols.claim(GV);
+      // Declarations keep their names, so that they link with the ones
+      // already in the batch.
+      for (auto &F : *M) {
+        if (F.empty())
+          Symbols.add(F.getName());
+        else
+          Symbols.claim(F);
+      }
+      if (Linker::linkModules(*OutM, std::move(M)))
+        return nullptr;
+    }
+  }
+  return OutM;
+}
+
+// The sidecar index of a batch, so that a corpus can be inspected and sampled
+// without loading it:
+//   {"functions": [{"name": "f", "position": 0, "instructions": 12,
+//                   "opcodes": {"add": 3, ...}, "hash": "..."}, ...]}
+// where position counts function definitions in module order and hash is the
+// getFunctionHash of the function.
+static bool writeIndex(const Module &M, StringRef Path) {
   std::error_code EC;
-  raw_fd_ostream OS(OutputFile.c_str(), EC, sys::fs::OF_Text);
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
   if (EC) {
     errs() << "Error opening file: " << EC.message() << '\n';
+    return false;
+  }
+  json::Array Functions;
+  uint32_t Position = 0;
+  for (auto &F : M) {
+    if (F.isDeclaration())
+      continue;
+    StringMap<int64_t> Histogram;
+    int64_t Instructions = 0;
+    for (auto &I : instructions(F)) {
+      ++Histogram[I.getOpcodeName()];
+      ++Instructions;
+    }
+    json::Object Opcodes;
+    for (auto &Entry : Histogram)
+      Opcodes[Entry.getKey().str()] = Entry.getValue();
+    Functions.push_back(json::Object{
+        {"name", F.getName().str()},
+        {"position", Position++},
+        {"instructions", Instructions},
+        {"opcodes", std::move(Opcodes)},
+        {"hash", utohexstr(getFunctionHash(F), /*LowerCase=*/true)}});
+  }
+  OS << json::Value(json::Object{{"functions", std::move(Functions)}}) << '\n';
+  return true;
+}
+
+static bool writeBatch(Module &M, StringRef Path) {
+  // TODO: set datalayout for pointer width
+  if (verifyModule(M, &errs()))
+    return false;
+  if (WriteIndex && !writeIndex(M, (Path + ".index.json").str()))
+    return false;
+  return writeModule(M, Path, EmitBitcode);
+}
+
+struct SeedFile {
+  std::string Path;
+  // Where the batch of the seed goes with --per-seed, relative to the output
+  // dir.
+  std::string Name;
+  // The functions to extract from the file, or all of them if empty.
+  std::vector<std::string> Functions;
+};
+
+// Expands the inputs and the manifest into seed files, in a stable order.
+// Directories are searched recursively for .ll and .bc files.
+static bool collectSeeds(std::vector<SeedFile> &Seeds) {
+  StringSet<> Names;
+  auto Add = [&](const fs::path &Path, fs::path Name) {
+    Name.replace_extension(EmitBitcode ? ".bc" : ".ll");
+    std::string Unique = Name.string();
+    for (uint32_t Id = 1; !Names.insert(Unique).second; ++Id)
+      Unique = (Name.parent_path() / (Name.stem().string() + "-" +
+                                      std::to_string(Id) +
+                                      Name.extension().string()))
+                   .string();
+    Seeds.push_back({Path.string(), Unique});
+  };
+  for (auto &Input : Inputs) {
+    fs::path Root(Input);
+    if (!fs::is_directory(Root)) {
+      Add(Root, Root.filename());
+      continue;
+    }
+    std::vector<fs::path> Files;
+    for (auto &Entry : fs::recursive_directory_iterator(Root)) {
+      auto Ext = Entry.path().extension();
+      if (Entry.is_regular_file() && (Ext == ".ll" || Ext == ".bc"))
+        Files.push_back(Entry.path());
+    }
+    llvm::sort(Files);
+    for (auto &File : Files)
+      Add(File, File.lexically_relative(Root));
+  }
+
+  if (Manifest.empty())
+    return true;
+  auto Buffer = MemoryBuffer::getFile(Manifest, /*IsText=*/true);
+  if (!Buffer) {
+    errs() << "Cannot read " << Manifest << ": "
+           << Buffer.getError().message() << '\n';
+    return false;
+  }
+  StringMap<size_t> Files;
+  for (line_iterator It(**Buffer); !It.is_at_eof(); ++It) {
+    auto [Path, Function] = It->split('\t');
+    Path = Path.trim();
+    Function = Function.trim();
+    if (Path.empty() || Function.empty()) {
+      errs() << Manifest << ':' << It.line_number()
+             << ": expected '<test file>\\t<function>'\n";
+      return false;
+    }
+    auto [Entry, Inserted] = Files.try_emplace(Path, Seeds.size());
+    if (Inserted)
+      Add(fs::path(Path.str()), fs::path(Path.str()).filename());
+    Seeds[Entry->second].Functions.push_back(Function.str());
+  }
+  return true;
+}
+
+// Keeps only the definitions of Names in M, like llvm-extract -func. Other
+// functions and global variables become declarations, and the declarations
+// left unused are dropped. Returns the names that M does not define.
+static std::vector<std::string> extractFunctions(Module &M,
+                                                 ArrayRef<std::string> Names) {
+  StringSet<> Wanted;
+  std::vector<std::string> Missing;
+  for (auto &Name : Names) {
+    Wanted.insert(Name);
+    Function *F = M.getFunction(Name);
+    if (!F || F->isDeclaration())
+      Missing.push_back(Name);
+  }
+
+  for (auto &IFunc : make_early_inc_range(M.ifuncs())) {
+    IFunc.replaceAllUsesWith(PoisonValue::get(IFunc.getType()));
+    IFunc.eraseFromParent();
+  }
+  for (auto &GV : make_early_inc_range(M.globals())) {
+    // llvm.used, llvm.global_ctors and the like cannot be declarations.
+    if (GV.hasAppendingLinkage()) {
+      GV.eraseFromParent();
+      continue;
+    }
+    if (!GV.isDeclaration()) {
+      GV.setInitializer(nullptr);
+      GV.setComdat(nullptr);
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+    }
+  }
+  for (auto &F : M) {
+    if (!F.isDeclaration() && !Wanted.contains(F.getName())) {
+      F.deleteBody();
+      F.setComdat(nullptr);
+    }
+  }
+
+  for (auto &F : make_early_inc_range(M))
+    if (F.isDeclaration() && F.use_empty())
+      F.eraseFromParent();
+  for (auto &GV : make_early_inc_range(M.globals()))
+    if (GV.use_empty())
+      GV.eraseFromParent();
+  return Missing;
+}
+
+// Bump when filterSeed changes, so that cached seeds filtered by an older
+// merge are not reused.
+static constexpr uint32_t FilterVersion = 1;
+
+// Filtered seeds are cached in CacheDir, keyed by the contents of the seed
+// file, the functions extracted from it, the filter options and the cache
+// tag, so that a hit skips parsing and filtering. An entry is a file holding
+// '<functions>\n' followed by the bitcode of the filtered seed if any function
+// is left. Entries are renamed into place, so concurrent runs never read a
+// partial one.
+static uint64_t getCacheKey(const SeedFile &Seed, StringRef Contents) {
+  uint64_t Data[] = {xxh3_64bits(Contents),
+                     xxh3_64bits(join(Seed.Functions, "\n")),
+                     xxh3_64bits(CacheTag), IgnoreFP, FilterVersion};
+  return xxh3_64bits(
+      ArrayRef(reinterpret_cast<const uint8_t *>(Data), sizeof(Data)));
+}
+
+static std::string getCachePath(uint64_t Key) {
+  SmallString<128> Path(CacheDir);
+  sys::path::append(Path, utohexstr(Key, /*LowerCase=*/true) + ".seed");
+  return std::string(Path);
+}
+
+static std::optional<uint32_t> lookupCache(uint64_t Key,
+                                           SmallVectorImpl<char> &Bitcode) {
+  auto Buffer = MemoryBuffer::getFile(getCachePath(Key), /*IsText=*/false);
+  if (!Buffer)
+    return std::nullopt;
+  auto [Count, Rest] = (*Buffer)->getBuffer().split('\n');
+  uint32_t Functions;
+  if (Count.getAsInteger(10, Functions) || (Functions != 0) != !Rest.empty())
+    return std::nullopt;
+  Bitcode.assign(Rest.begin(), Rest.end());
+  return Functions;
+}
+
+static void insertCache(uint64_t Key, uint32_t Functions,
+                        ArrayRef<char> Bitcode) {
+  std::string Path = getCachePath(Key);
+  SmallString<128> TmpPath;
+  int FD;
+  if (sys::fs::createUniqueFile(Path + "-%%%%%%.tmp", FD, TmpPath))
+    return;
+  raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  OS << Functions << '\n';
+  OS.write(Bitcode.data(), Bitcode.size());
+  OS.close();
+  if (OS.has_error()) {
+    OS.clear_error();
+    sys::fs::remove(TmpPath);
+    return;
+  }
+  if (sys::fs::rename(TmpPath, Path))
+    sys::fs::remove(TmpPath);
+}
+
+// A function of a filtered seed, as seen by --distill.
+struct FunctionInfo {
+  std::string Name;
+  // Equal for functions of the same shape: the same instructions, predicates
+  // and intrinsics in the same order, on scalars or on vectors of similar
+  // length, with the same kinds of operands, whatever the bit widths and the
+  // order of commutative operands.
+  uint64_t Signature = 0;
+  uint32_t Instructions = 0;
+  // The opcodes, predicates and intrinsics the function uses, on scalars or
+  // vectors, with or without poison-generating flags.
+  std::vector<uint64_t> Features;
+  bool Kept = false;
+};
+
+static FunctionInfo describeFunction(const Function &F) {
+  FunctionInfo Info;
+  Info.Name = F.getName().str();
+  // Without details, StructuralHash covers the opcodes and the shape of the
+  // CFG but not the types.
+  SmallVector<uint64_t, 64> Shape = {StructuralHash(F), F.arg_size()};
+  DenseMap<const Instruction *, uint32_t> Numbers;
+  DenseSet<uint64_t> Features;
+  for (auto &I : instructions(F)) {
+    uint32_t Number = Numbers.size();
+    Numbers[&I] = Number;
+    ++Info.Instructions;
+
+    uint64_t Code = uint64_t(I.getOpcode()) << 32;
+    if (auto *Cmp = dyn_cast<CmpInst>(&I))
+      Code |= Cmp->getPredicate();
+    else if (auto *II = dyn_cast<IntrinsicInst>(&I))
+      Code |= II->getIntrinsicID();
+    // Vectors keep their own shape: 0 for scalars, then one class per power
+    // of two of the (minimum) element count, scalable vectors apart.
+    Type *Ty = I.getType();
+    if (!Ty->isVectorTy() && I.getNumOperands())
+      Ty = I.getOperand(0)->getType();
+    uint64_t VectorClass = 0;
+    if (auto *VecTy = dyn_cast<VectorType>(Ty)) {
+      ElementCount EC = VecTy->getElementCount();
+      VectorClass = 2 * (Log2_32_Ceil(EC.getKnownMinValue()) + 1) +
+                    EC.isScalable();
+    }
+    Features.insert(Code | uint64_t(VectorClass != 0) << 24 |
+                    uint64_t(I.hasPoisonGeneratingFlags()) << 25);
+
+    SmallVector<uint64_t, 4> Operands;
+    for (const Use &U : I.operands()) {
+      const Value *V = U.get();
+      uint64_t Kind = 0;
+      if (auto *Op = dyn_cast<Instruction>(V)) {
+        // Earlier instructions are told apart by their distance, so that the
+        // data flow is part of the shape.
+        auto It = Numbers.find(Op);
+        Kind = It == Numbers.end() ? 2 : 8 + Number - It->second;
+      } else if (isa<Argument>(V)) {
+        Kind = 1;
+      } else if (isa<BasicBlock>(V)) {
+        Kind = 3;
+      } else if (isa<UndefValue>(V)) {
+        Kind = 4;
+      } else if (auto *C = dyn_cast<Constant>(V); C && !isa<GlobalValue>(C)) {
+        if (C->isNullValue())
+          Kind = 5;
+        else if (C->isOneValue() || C->isAllOnesValue())
+          Kind = 6;
+        else
+          Kind = 7;
+      }
+      Operands.push_back(Kind);
+    }
+    if (I.isCommutative() && Operands.size() >= 2 && Operands[1] < Operands[0])
+      std::swap(Operands[0], Operands[1]);
+    Shape.push_back(Code);
+    Shape.push_back(VectorClass);
+    Shape.push_back(Operands.size());
+    Shape.append(Operands.begin(), Operands.end());
+  }
+
+  Info.Signature = xxh3_64bits(ArrayRef(
+      reinterpret_cast<const uint8_t *>(Shape.data()), Shape.size() * 8));
+  Info.Features.assign(Features.begin(), Features.end());
+  return Info;
+}
+
+struct SeedResult {
+  // Diagnostics, printed in input order.
+  std::string Errors;
+  uint32_t Functions = 0;
+  bool Cached = false;
+  // The filtered seed, to be linked into the batch of all seeds, or with
+  // --distill, to be written once the kept functions are known.
+  SmallVector<char, 0> Bitcode;
+  // With --distill, the functions of the filtered seed.
+  std::vector<FunctionInfo> Infos;
+  uint64_t ParseMs = 0, FilterMs = 0, LinkMs = 0, WriteMs = 0;
+};
+
+// Marks the functions that --distill keeps: the smallest function of each
+// signature and, if there are more signatures than DistillBudget, the ones
+// picked greedily for the features they add. Returns the number of
+// signatures and of functions kept.
+static std::pair<uint32_t, uint32_t>
+distill(MutableArrayRef<SeedResult> Results) {
+  DenseMap<uint64_t, FunctionInfo *> Representatives;
+  std::vector<uint64_t> Signatures;
+  for (auto &Res : Results) {
+    for (auto &Info : Res.Infos) {
+      auto [It, Inserted] = Representatives.try_emplace(Info.Signature, &Info);
+      if (Inserted)
+        Signatures.push_back(Info.Signature);
+      else if (Info.Instructions < It->second->Instructions)
+        It->second = &Info;
+    }
+  }
+  std::vector<FunctionInfo *> Candidates;
+  for (uint64_t Signature : Signatures)
+    Candidates.push_back(Representatives[Signature]);
+  if (!DistillBudget || Candidates.size() <= DistillBudget) {
+    for (auto *Info : Candidates)
+      Info->Kept = true;
+    return {Candidates.size(), Candidates.size()};
+  }
+
+  // The gain of a candidate only shrinks as features get covered, so gains
+  // are refreshed lazily: a candidate whose refreshed gain is still the
+  // largest is the best one. Ties go to smaller and then earlier functions.
+  DenseSet<uint64_t> Covered;
+  auto GetGain = [&](const FunctionInfo *Info) {
+    return static_cast<size_t>(count_if(
+        Info->Features, [&](uint64_t F) { return !Covered.contains(F); }));
+  };
+  using Entry = std::tuple<size_t, int64_t, int64_t>;
+  std::priority_queue<Entry> Queue;
+  for (size_t I = 0; I != Candidates.size(); ++I)
+    Queue.emplace(GetGain(Candidates[I]), -int64_t(Candidates[I]->Instructions),
+                  -int64_t(I));
+  uint32_t Kept = 0;
+  while (Kept != DistillBudget && !Queue.empty()) {
+    auto [Gain, NegSize, NegIdx] = Queue.top();
+    Queue.pop();
+    FunctionInfo *Info = Candidates[-NegIdx];
+    size_t Fresh = GetGain(Info);
+    if (Fresh < Gain) {
+      Queue.emplace(Fresh, NegSize, NegIdx);
+      continue;
+    }
+    Info->Kept = true;
+    Covered.insert(Info->Features.begin(), Info->Features.end());
+    ++Kept;
+  }
+  return {Candidates.size(), Kept};
+}
+
+// Erases the functions of M that --distill did not keep. Returns the number of
+// definitions left.
+static uint32_t dropFunctions(Module &M, ArrayRef<FunctionInfo> Infos) {
+  StringSet<> Kept;
+  for (auto &Info : Infos)
+    if (Info.Kept)
+      Kept.insert(Info.Name);
+  uint32_t Left = 0;
+  for (auto &F : make_early_inc_range(M)) {
+    if (F.isDeclaration())
+      continue;
+    if (Kept.contains(F.getName())) {
+      ++Left;
+      continue;
+    }
+    F.replaceAllUsesWith(PoisonValue::get(F.getType()));
+    F.eraseFromParent();
+  }
+  return Left;
+}
+
+// Builds and writes the batch of a seed with --per-seed.
+static void writeSeedBatch(const SeedFile &Seed, std::unique_ptr<Module> M,
+                           LLVMContext &Ctx, SeedResult &Res) {
+  auto Start = Clock::now();
+  std::unique_ptr<Module> Seeds[] = {std::move(M)};
+  std::unique_ptr<Module> Batch = buildBatch(Ctx, Seeds);
+  Res.LinkMs = getElapsedMs(Start);
+  SmallString<128> Path(OutputFile);
+  sys::path::append(Path, Seed.Name);
+  Start = Clock::now();
+  if (!Batch || sys::fs::create_directories(sys::path::parent_path(Path)) ||
+      !writeBatch(*Batch, Path)) {
+    raw_string_ostream(Res.Errors)
+        << "merge: cannot write the batch of " << Seed.Path << '\n';
+    Res.Functions = 0;
+  }
+  Res.WriteMs = getElapsedMs(Start);
+}
+
+// Parses and filters one seed in a context of its own, so that seeds are
+// processed in parallel. With --per-seed, its batch is also built and written
+// here; otherwise, or with --distill, it is handed back as bitcode.
+static void processSeed(const SeedFile &Seed, SeedResult &Res) {
+  LLVMContext Ctx;
+  SMDiagnostic Err;
+  raw_string_ostream Errors(Res.Errors);
+  auto Start = Clock::now();
+  auto Buffer = MemoryBuffer::getFile(Seed.Path, /*IsText=*/true);
+  if (!Buffer) {
+    Errors << "merge: cannot read " << Seed.Path << ": "
+           << Buffer.getError().message() << '\n';
+    return;
+  }
+
+  std::unique_ptr<Module> M;
+  uint64_t Key = 0;
+  if (!CacheDir.empty()) {
+    Key = getCacheKey(Seed, (*Buffer)->getBuffer());
+    if (auto Functions = lookupCache(Key, Res.Bitcode)) {
+      Res.Cached = true;
+      Res.Functions = *Functions;
+      if (CacheOnly)
+        Res.Bitcode = {};
+      if (!Res.Functions || CacheOnly || (!PerSeed && !Distill)) {
+        Res.ParseMs = getElapsedMs(Start);
+        return;
+      }
+      auto Cached = parseBitcodeFile(
+          MemoryBufferRef(StringRef(Res.Bitcode.data(), Res.Bitcode.size()),
+                          Seed.Path),
+          Ctx);
+      // A broken entry is treated as a miss and overwritten.
+      if (Cached) {
+        M = std::move(*Cached);
+      } else {
+        consumeError(Cached.takeError());
+        Res.Cached = false;
+      }
+    }
+  }
+
+  if (!M) {
+    M = parseIR((*Buffer)->getMemBufferRef(), Err, Ctx);
+    if (!M) {
+      Err.print("merge", Errors);
+      return;
+    }
+    Res.ParseMs = getElapsedMs(Start);
+
+    Start = Clock::now();
+    if (!Seed.Functions.empty())
+      for (auto &Name : extractFunctions(*M, Seed.Functions))
+        Errors << "merge: " << Seed.Path << " does not define @" << Name
+               << '\n';
+    Res.Functions = filterSeed(*M);
+    Res.FilterMs = getElapsedMs(Start);
+    Res.Bitcode.clear();
+    if (Res.Functions && (!PerSeed || Distill || !CacheDir.empty())) {
+      raw_svector_ostream OS(Res.Bitcode);
+      WriteBitcodeToFile(*M, OS);
+    }
+    if (!CacheDir.empty())
+      insertCache(Key, Res.Functions, Res.Bitcode);
+    if (CacheOnly) {
+      Res.Bitcode = {};
+      return;
+    }
+  } else {
+    Res.ParseMs = getElapsedMs(Start);
+  }
+  if (!Res.Functions)
+    return;
+  if (Distill) {
+    for (auto &F : *M)
+      if (!F.isDeclaration())
+        Res.Infos.push_back(describeFunction(F));
+    return;
+  }
+  if (!PerSeed)
+    return;
+  Res.Bitcode = {};
+  writeSeedBatch(Seed, std::move(M), Ctx, Res);
+}
+
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "merge\n");
+
+  auto WallStart = Clock::now();
+  if (CacheOnly && CacheDir.empty()) {
+    errs() << "--cache-only requires --cache\n";
+    return EXIT_FAILURE;
+  }
+  if (!CacheDir.empty()) {
+    if (std::error_code EC = sys::fs::create_directories(CacheDir)) {
+      errs() << "Cannot create the seed cache: " << EC.message() << '\n';
+      if (CacheOnly)
+        return EXIT_FAILURE;
+      CacheDir.setValue("");
+    }
+  }
+  std::vector<SeedFile> Seeds;
+  if (!collectSeeds(Seeds))
+    return EXIT_FAILURE;
+  std::vector<SeedResult> Results(Seeds.size());
+  {
+    DefaultThreadPool Pool(hardware_concurrency(Jobs));
+    for (size_t I = 0; I != Seeds.size(); ++I)
+      Pool.async([&, I] { processSeed(Seeds[I], Results[I]); });
+    Pool.wait();
+  }
+
+  // Seeds that fail to parse are skipped, as a test suite has some on
+  // purpose.
+  uint64_t ParseMs = 0, FilterMs = 0, LinkMs = 0, WriteMs = 0;
+  uint32_t NumAccepted = 0, NumFunctions = 0, NumCached = 0;
+  for (auto &Res : Results) {
+    errs() << Res.Errors;
+    Res.Errors.clear();
+    ParseMs += Res.ParseMs;
+    FilterMs += Res.FilterMs;
+    NumAccepted += Res.Functions != 0;
+    NumFunctions += Res.Functions;
+    NumCached += Res.Cached;
+  }
+  if (CacheOnly) {
+    if (PrintTiming)
+      errs() << "merge: parse " << ParseMs << "ms, filter " << FilterMs
+             << "ms, wall " << getElapsedMs(WallStart) << "ms ("
+             << Seeds.size() << " seeds, " << NumAccepted << " accepted, "
+             << NumFunctions << " functions, " << NumCached << " cached)\n";
+    return EXIT_SUCCESS;
+  }
+  if (!NumAccepted) {
+    errs() << "No valid functions found in";
+    for (auto &Input : Inputs)
+      errs() << ' ' << Input;
+    if (!Manifest.empty())
+      errs() << ' ' << Manifest;
+    errs() << '\n';
     return EXIT_FAILURE;
   }
 
-  OutM.print(OS, nullptr);
+  if (Distill) {
+    auto [Signatures, Kept] = distill(Results);
+    errs() << "merge: distilled " << NumFunctions << " functions with "
+           << Signatures << " shapes into " << Kept
+           << format(" (%.1f%% fewer)\n",
+                     100.0 * (NumFunctions - Kept) / NumFunctions);
+  }
+
+  if (PerSeed && Distill) {
+    DefaultThreadPool Pool(hardware_concurrency(Jobs));
+    for (size_t I = 0; I != Seeds.size(); ++I) {
+      if (Results[I].Bitcode.empty())
+        continue;
+      Pool.async([&, I] {
+        SeedResult &Res = Results[I];
+        LLVMContext Ctx;
+        auto M = parseBitcodeFile(
+            MemoryBufferRef(StringRef(Res.Bitcode.data(), Res.Bitcode.size()),
+                            Seeds[I].Path),
+            Ctx);
+        if (!M) {
+          raw_string_ostream(Res.Errors) << toString(M.takeError()) << '\n';
+          return;
+        }
+        if (dropFunctions(**M, Res.Infos))
+          writeSeedBatch(Seeds[I], std::move(*M), Ctx, Res);
+        Res.Bitcode = {};
+      });
+    }
+    Pool.wait();
+  }
+  for (auto &Res : Results) {
+    errs() << Res.Errors;
+    LinkMs += Res.LinkMs;
+    WriteMs += Res.WriteMs;
+  }
+
+  uint64_t BatchFunctions = 0;
+  if (!PerSeed) {
+    LLVMContext Ctx;
+    auto Start = Clock::now();
+    std::vector<std::unique_ptr<Module>> Filtered;
+    for (size_t I = 0; I != Seeds.size(); ++I) {
+      auto &Bitcode = Results[I].Bitcode;
+      if (Bitcode.empty())
+        continue;
+      Expected<std::unique_ptr<Module>> M = parseBitcodeFile(
+          MemoryBufferRef(StringRef(Bitcode.data(), Bitcode.size()),
+                          Seeds[I].Path),
+          Ctx);
+      if (!M) {
+        errs() << toString(M.takeError()) << '\n';
+        return EXIT_FAILURE;
+      }
+      if (Distill && !dropFunctions(**M, Results[I].Infos))
+        continue;
+      Filtered.push_back(std::move(*M));
+    }
+    std::unique_ptr<Module> Batch = buildBatch(Ctx, Filtered);
+    if (!Batch)
+      return EXIT_FAILURE;
+    LinkMs += getElapsedMs(Start);
+
+    Start = Clock::now();
+    if (!writeBatch(*Batch, OutputFile))
+      return EXIT_FAILURE;
+    WriteMs += getElapsedMs(Start);
+    BatchFunctions = Batch->size();
+  }
+
+  // Stage times are summed over the threads.
+  if (PrintTiming) {
+    errs() << "merge: parse " << ParseMs << "ms, filter " << FilterMs
+           << "ms, link " << LinkMs << "ms, write " << WriteMs << "ms, wall "
+           << getElapsedMs(WallStart) << "ms (" << Seeds.size() << " seeds, "
+           << NumAccepted << " accepted, " << NumFunctions << " functions, "
+           << NumCached << " cached";
+    if (!PerSeed)
+      errs() << ", " << BatchFunctions << " in batch";
+    errs() << ")\n";
+  }
   return EXIT_SUCCESS;
 }
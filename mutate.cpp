@@ -3,970 +3,457 @@
 // This file is licensed under the Apache-2.0 License.
 // See the LICENSE file for more information.
 
-#include <llvm/ADT/APFloat.h>
-#include <llvm/ADT/APInt.h>
-#include <llvm/ADT/DenseMap.h>
+#include "io.h"
+#include "mutator.h"
 #include <llvm/ADT/STLExtras.h>
-#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/SmallVector.h>
-#include <llvm/Analysis/InstructionSimplify.h>
-#include <llvm/IR/Argument.h>
-#include <llvm/IR/Attributes.h>
-#include <llvm/IR/BasicBlock.h>
-#include <llvm/IR/Constant.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/Constants.h>
-#include <llvm/IR/DataLayout.h>
-#include <llvm/IR/DerivedTypes.h>
-#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
-#include <llvm/IR/GEPNoWrapFlags.h>
-#include <llvm/IR/GlobalVariable.h>
-#include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/InstVisitor.h>
-#include <llvm/IR/InstrTypes.h>
-#include <llvm/IR/Instruction.h>
-#include <llvm/IR/Instructions.h>
-#include <llvm/IR/IntrinsicInst.h>
-#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
-#include <llvm/IR/Operator.h>
-#include <llvm/IR/PassInstrumentation.h>
-#include <llvm/IR/PatternMatch.h>
-#include <llvm/IR/Type.h>
-#include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
-#include <llvm/IRPrinter/IRPrintingPasses.h>
 #include <llvm/IRReader/IRReader.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Error.h>
 #include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/FileSystem.h>
-#include <llvm/Support/FormattedStream.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/InitLLVM.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/Timer.h>
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 #include <cstdlib>
-#include <random>
+#include <iostream>
 #include <string>
 
 using namespace llvm;
-using namespace PatternMatch;
 
 static cl::opt<std::string> SeedFile(cl::Positional, cl::desc("<seed>"),
                                      cl::Required, cl::value_desc("seed file"));
 static cl::opt<std::string> OutputFile(cl::Positional, cl::desc("<output>"),
-                                       cl::Required,
                                        cl::value_desc("output file"));
 static cl::opt<std::string> Recipe(cl::Positional, cl::desc("<recipe>"),
-                                   cl::Required, cl::value_desc("recipe"));
+                                   cl::value_desc("recipe"));
+static cl::opt<uint32_t>
+    Count("count",
+          cl::desc("Number of mutants to generate from a single parse of the "
+                   "seed. When greater than 1, <output> is a pattern and "
+                   "'%d' is replaced with the index of each mutant"),
+          cl::init(1));
+static cl::opt<bool> EmitBitcode("emit-bc",
+                                 cl::desc("Write bitcode instead of textual IR"),
+                                 cl::init(false));
+static cl::opt<uint32_t> TimeIO(
+    "time-io",
+    cl::desc("Print and parse the seed N times, as textual IR and as "
+             "bitcode, and report the time spent in each stage"),
+    cl::init(0));
+static cl::opt<bool>
+    Serve("serve",
+          cl::desc("Keep the seed resident and answer requests read line by "
+                   "line from stdin, e.g. 'recipe=correctness out=a.ll "
+                   "rng-seed=42 journal=a.json', or 'stats'. Each request is "
+                   "answered with one line on stdout: 'ok', 'stats ...' or "
+                   "'error <message>'. With --dedup, 'ok' is followed by "
+                   "' duplicates=D/N': D of the N function mutants made for "
+                   "the request were rejected as duplicates"),
+          cl::init(false));
+static cl::opt<uint32_t> RecycleAfter(
+    "recycle-after",
+    cl::desc("Number of requests after which --serve drops the LLVMContext "
+             "and parses the seed again"),
+    cl::init(256));
+static cl::opt<uint64_t> RngSeed(
+    "rng-seed",
+    cl::desc("Seed of the first mutant. Mutant N (or request N of --serve) "
+             "uses this seed plus N, so the seed file, the recipe and the seed "
+             "reproduce a mutant exactly. Random if not given"));
+static cl::opt<uint32_t>
+    Threads("threads",
+            cl::desc("Number of threads used to mutate the functions of a "
+                     "mutant concurrently (0 = all cores)"),
+            cl::init(1));
+static cl::opt<std::string>
+    JournalFile("journal",
+                cl::desc("Write the edits applied to the mutant as a JSON "
+                         "journal. With --count, '%d' is replaced as in "
+                         "<output>"),
+                cl::value_desc("journal file"));
+static cl::opt<std::string>
+    ReplayFile("replay",
+               cl::desc("Instead of running a recipe, apply the edits of a "
+                        "journal to the seed"),
+               cl::value_desc("journal file"));
+static cl::opt<bool>
+    Dedup("dedup",
+          cl::desc("Reject function mutants that this process has already "
+                   "produced for the same recipe and try again. The duplicate "
+                   "rate of each recipe is printed to stderr at exit, and in "
+                   "--serve mode is also the answer to a 'stats' request. A "
+                   "mutant then depends on the ones before it, so --rng-seed "
+                   "alone no longer reproduces it; its journal does"),
+          cl::init(false));
+static cl::opt<uint32_t>
+    Sample("sample",
+           cl::desc("Number of seed functions each mutant is made of, picked "
+                    "at random with its seed (0 = all of them). A bitcode "
+                    "seed is then loaded lazily, and only the functions that "
+                    "are picked are ever read. The sample is recorded in the "
+                    "journal, and --replay picks the same functions"),
+           cl::init(0));
+static cl::opt<size_t>
+    ReplayEdits("replay-edits",
+                cl::desc("Only replay the first N edits of the journal, e.g. "
+                         "to bisect which edit matters"),
+                cl::init(SIZE_MAX));
 
-std::mt19937_64 Gen(std::random_device{}());
-bool randomBool() { return std::uniform_int_distribution<>{0, 1}(Gen); }
-uint32_t randomUInt(uint32_t Max) {
-  return std::uniform_int_distribution<uint32_t>{0, Max}(Gen);
+static std::string expandPattern(StringRef Pattern, uint32_t Idx) {
+  std::string Path = Pattern.str();
+  if (Count == 1)
+    return Path;
+  Path.replace(Path.find("%d"), 2, std::to_string(Idx));
+  return Path;
 }
-int32_t randomInt(int32_t Min, int32_t Max) {
-  return std::uniform_int_distribution<int32_t>{Min, Max}(Gen);
-}
-int32_t randomIntNotEqual(int32_t Min, int32_t Max, int32_t NotEqual) {
-  while (true) {
-    int32_t Value = randomInt(Min, Max);
-    if (Value != NotEqual)
-      return Value;
-  }
-}
-// Mutators
-
-bool mutateConstant(Instruction &I) {
-  if (isa<GetElementPtrInst>(I) || isa<SwitchInst>(I) ||
-      match(&I, m_Intrinsic<Intrinsic::is_fpclass>()) || isa<PHINode>(I))
-    return false;
-  for (auto &Op : I.operands()) {
-    if (!isa<Constant>(Op.get()))
-      continue;
-    if (randomBool())
-      continue;
-    const APInt *C;
-    if (match(Op.get(), m_APInt(C))) {
-      if (I.isShift() && &Op == &I.getOperandUse(1)) {
-        Op.set(ConstantInt::get(
-            Op->getType(),
-            APInt(C->getBitWidth(), randomUInt(C->getBitWidth() - 1))));
-        return true;
-      }
-      if (I.getOpcode() == Instruction::ExtractElement &&
-          &Op == &I.getOperandUse(1)) {
-        Op.set(ConstantInt::get(
-            Op->getType(),
-            APInt(C->getBitWidth(),
-                  randomUInt(cast<VectorType>(I.getOperand(0)->getType())
-                                 ->getElementCount()
-                                 .getKnownMinValue() -
-                             1))));
-        return true;
-      }
-      if (I.getOpcode() == Instruction::ExtractValue &&
-          &Op == &I.getOperandUse(1)) {
-        Type *SrcTy = I.getOperand(0)->getType();
-        Op.set(ConstantInt::get(
-            Op->getType(),
-            APInt(C->getBitWidth(),
-                  randomUInt((SrcTy->isStructTy()
-                                  ? SrcTy->getStructNumElements()
-                                  : SrcTy->getArrayNumElements()) -
-                             1))));
-        return true;
-      }
 
-      switch (randomUInt(3)) {
-      case 0: {
-        // Special values
-        switch (randomUInt(4)) {
-        case 0:
-          Op.set(ConstantInt::get(Op->getType(), 0));
-          break;
-        case 1:
-          Op.set(ConstantInt::get(Op->getType(), 1));
-          break;
-        case 2:
-          Op.set(ConstantInt::get(Op->getType(), -1, /*IsSigned=*/true));
-          break;
-        case 3:
-          Op.set(ConstantInt::get(Op->getType(),
-                                  APInt::getSignedMaxValue(C->getBitWidth())));
-          break;
-        case 4:
-          Op.set(ConstantInt::get(Op->getType(),
-                                  APInt::getSignedMinValue(C->getBitWidth())));
-          break;
-        }
-        break;
-      }
-      case 1: {
-        // Negate
-        Op.set(ConstantInt::get(Op->getType(), -(*C)));
-        break;
-      }
-      case 2: {
-        // Inversion
-        Op.set(ConstantInt::get(Op->getType(), ~(*C)));
-        break;
-      }
-      case 3: {
-        // Random value
-        if (C->getBitWidth() < 64)
-          return false;
-        Op.set(ConstantInt::get(
-            Op->getType(),
-            APInt(C->getBitWidth(),
-                  std::uniform_int_distribution<uint64_t>{0}(Gen))));
-        break;
-      }
-      }
-      return true;
-    }
-    const APFloat *F;
-    if (match(Op.get(), m_APFloat(F))) {
-      APFloat New = *F;
-      switch (randomUInt(4)) {
-      case 0:
-        New.changeSign();
-        break;
-      case 1:
-        New.next(true);
-        break;
-      case 2:
-        New.next(false);
-        break;
-      case 3: {
-        uint64_t Raw = Gen();
-        unsigned BitWidth = APFloat::getSizeInBits(New.getSemantics());
-        New = APFloat(New.getSemantics(), APInt(BitWidth, Raw, false, true));
-        break;
-      }
-      case 4: {
-        switch (randomUInt(5)) {
-        case 0:
-          New = APFloat::getZero(New.getSemantics());
-          break;
-        case 1:
-          New = APFloat::getInf(New.getSemantics());
-          break;
-        case 2:
-          New = APFloat::getQNaN(New.getSemantics());
-          break;
-        case 3:
-          New = APFloat::getSmallest(New.getSemantics());
-          break;
-        case 4:
-          New = APFloat::getLargest(New.getSemantics());
-          break;
-        case 5:
-          New = APFloat::getSmallestNormalized(New.getSemantics());
-          break;
-        }
-        if (randomBool())
-          New.changeSign();
-        break;
-      }
-      }
-      if (New.bitwiseIsEqual(*F))
-        return false;
-      Op.set(ConstantFP::get(Op->getType(), New));
-      return true;
-    }
+static std::unique_ptr<Module> loadSeed(LLVMContext &Ctx, bool Lazy = false) {
+  SMDiagnostic Err;
+  auto M = Lazy ? getLazyIRFileModule(SeedFile, Err, Ctx)
+                : parseIRFile(SeedFile, Err, Ctx);
+  if (!M) {
+    Err.print("mutate", errs());
+    return nullptr;
   }
-  return false;
+
+  if (none_of(*M, [](Function &F) { return !F.isDeclaration(); }))
+    return nullptr;
+
+  return M;
 }
-bool mutateFlags(Instruction &I, bool Add) {
-  if (auto *OBO = dyn_cast<OverflowingBinaryOperator>(&I)) {
-    if (Add) {
-      if (randomBool()) {
-        if (!OBO->hasNoUnsignedWrap()) {
-          I.setHasNoUnsignedWrap();
-          return true;
-        }
-      } else {
-        if (!OBO->hasNoSignedWrap()) {
-          I.setHasNoSignedWrap();
-          return true;
-        }
-      }
-    } else {
-      if (randomBool()) {
-        if (OBO->hasNoUnsignedWrap()) {
-          I.setHasNoUnsignedWrap(false);
-          return true;
-        }
-      } else {
-        if (OBO->hasNoSignedWrap()) {
-          I.setHasNoSignedWrap(false);
-          return true;
-        }
-      }
-    }
-  }
-  if (auto *Exact = dyn_cast<PossiblyExactOperator>(&I)) {
-    if (Add) {
-      if (!Exact->isExact()) {
-        I.setIsExact();
-        return true;
-      }
-    } else {
-      if (Exact->isExact()) {
-        I.setIsExact(false);
-        return true;
-      }
-    }
-  }
-  if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
-    if (Add) {
-      switch (randomUInt(2)) {
-      case 0:
-        if (!GEP->isInBounds()) {
-          GEP->setIsInBounds(true);
-          return true;
-        }
-        break;
-      case 1:
-        if (!GEP->getNoWrapFlags().hasNoUnsignedWrap()) {
-          GEP->setNoWrapFlags(GEP->getNoWrapFlags() |
-                              GEPNoWrapFlags::noUnsignedWrap());
-          return true;
-        }
-        break;
-      case 2:
-        if (!GEP->getNoWrapFlags().hasNoUnsignedSignedWrap()) {
-          GEP->setNoWrapFlags(GEP->getNoWrapFlags() |
-                              GEPNoWrapFlags::noUnsignedSignedWrap());
-          return true;
-        }
-        break;
-      }
-    } else {
-      switch (randomUInt(2)) {
-      case 0:
-        if (GEP->isInBounds()) {
-          GEP->setIsInBounds(false);
-          return true;
-        }
-        break;
-      case 1:
-        if (GEP->getNoWrapFlags().hasNoUnsignedWrap()) {
-          GEP->setNoWrapFlags(GEP->getNoWrapFlags().withoutNoUnsignedWrap());
-          return true;
-        }
-        break;
-      case 2:
-        if (GEP->getNoWrapFlags().hasNoUnsignedSignedWrap()) {
-          GEP->setNoWrapFlags(
-              GEP->getNoWrapFlags().withoutNoUnsignedSignedWrap());
-          return true;
-        }
-        break;
-      }
-    }
-  }
-  if (auto *Trunc = dyn_cast<TruncInst>(&I)) {
-    if (Add) {
-      if (randomBool()) {
-        if (!Trunc->hasNoUnsignedWrap()) {
-          I.setHasNoUnsignedWrap();
-          return true;
-        }
-      } else {
-        if (!Trunc->hasNoSignedWrap()) {
-          I.setHasNoSignedWrap();
-          return true;
-        }
-      }
-    } else {
-      if (randomBool()) {
-        if (Trunc->hasNoUnsignedWrap()) {
-          I.setHasNoUnsignedWrap(false);
-          return true;
-        }
-      } else {
-        if (Trunc->hasNoSignedWrap()) {
-          I.setHasNoSignedWrap(false);
-          return true;
-        }
-      }
-    }
-  }
-  if (auto *Disjoint = dyn_cast<PossiblyDisjointInst>(&I)) {
-    if (Add) {
-      if (!Disjoint->isDisjoint()) {
-        Disjoint->setIsDisjoint(true);
-        return true;
-      }
-    } else {
-      if (Disjoint->isDisjoint()) {
-        Disjoint->setIsDisjoint(false);
-        return true;
-      }
-    }
-  }
-  if (auto *NNeg = dyn_cast<PossiblyNonNegInst>(&I)) {
-    if (Add) {
-      if (!NNeg->hasNonNeg()) {
-        NNeg->setNonNeg();
-        return true;
-      }
-    } else {
-      if (NNeg->hasNonNeg()) {
-        NNeg->setNonNeg(false);
-        return true;
-      }
-    }
-  }
-  if (auto *ICmp = dyn_cast<ICmpInst>(&I)) {
-    if (Add) {
-      if (!ICmp->hasSameSign()) {
-        ICmp->setSameSign();
-        return true;
-      }
-    } else {
-      if (ICmp->hasSameSign()) {
-        ICmp->setSameSign(false);
-        return true;
-      }
-    }
-  }
-  if (auto *FPOp = dyn_cast<FPMathOperator>(&I)) {
-    if (Add) {
-      switch (randomUInt(1)) {
-      case 0:
-        if (!FPOp->hasNoInfs()) {
-          I.setHasNoInfs(true);
-          return true;
-        }
-        break;
-      case 1:
-        if (!FPOp->hasNoNaNs()) {
-          I.setHasNoNaNs(true);
-          return true;
-        }
-        break;
-        // case 2:
-        //   if (!FPOp->hasNoSignedZeros()) {
-        //     // See
-        //     //
-        //     https://discourse.llvm.org/t/rfc-clarify-the-behavior-of-fp-operations-on-bit-strings-with-nsz-flag/85981
-        //     if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
-        //       auto IID = II->getIntrinsicID();
-        //       if (IID == Intrinsic::fabs || IID == Intrinsic::copysign)
-        //         return false;
-        //     }
-        //     if (I.getOpcode() == Instruction::FNeg ||
-        //         I.getOpcode() == Instruction::Select)
-        //       return false;
-        //     I.setHasNoSignedZeros(true);
-        //     return true;
-        //   }
-        //   break;
-      }
-    } else {
-      switch (randomUInt(2)) {
-      case 0:
-        if (FPOp->hasNoInfs()) {
-          I.setHasNoInfs(false);
-          return true;
-        }
-        break;
-      case 1:
-        if (FPOp->hasNoNaNs()) {
-          I.setHasNoNaNs(false);
-          return true;
-        }
-        break;
-      case 2:
-        if (FPOp->hasNoSignedZeros()) {
-          I.setHasNoSignedZeros(false);
-          return true;
-        }
-        break;
-      }
-    }
-  }
-  if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
-    if (II->getType()->isIntOrIntVectorTy() && randomBool()) {
-      // ret attr
-      if (Add) {
-        if (!II->hasRetAttr(Attribute::NoUndef)) {
-          II->addRetAttr(Attribute::NoUndef);
-          return true;
-        }
-      } else {
-        if (II->hasRetAttr(Attribute::NoUndef)) {
-          II->removeRetAttr(Attribute::NoUndef);
-          return true;
-        }
-      }
-    } else {
-      switch (II->getIntrinsicID()) {
-      case Intrinsic::abs:
-      case Intrinsic::ctlz:
-      case Intrinsic::cttz:
-        if (Add == cast<Constant>(II->getArgOperand(1))->isNullValue()) {
-          II->setArgOperand(
-              1, ConstantInt::getBool(II->getArgOperand(1)->getType(), Add));
-          return true;
-        }
-      default:
-        break;
-      }
-    }
+
+// Returns a copy of Seed to mutate with MutantSeed. With a sample, it only has
+// the SampleCount functions picked for the mutant, which are materialized on
+// demand.
+static Expected<std::unique_ptr<Module>>
+copySeed(Module &Seed, uint64_t MutantSeed, uint32_t SampleCount = Sample) {
+  if (!SampleCount)
+    return CloneModule(Seed);
+
+  SmallVector<Function *> Defined;
+  for (auto &F : Seed)
+    if (!F.isDeclaration())
+      Defined.push_back(&F);
+  SmallPtrSet<const GlobalValue *, 16> Picked;
+  for (uint32_t Idx : sampleIndices(Defined.size(), SampleCount, MutantSeed)) {
+    if (Error E = Defined[Idx]->materialize())
+      return std::move(E);
+    Picked.insert(Defined[Idx]);
   }
-  return false;
-}
-bool addFlags(Instruction &I) { return mutateFlags(I, /*Add=*/true); }
-bool dropFlags(Instruction &I) { return mutateFlags(I, /*Add=*/false); }
-bool createNewInst(Instruction &Old, function_ref<Value *(IRBuilder<> &)> New) {
-  IRBuilder<> Builder(&Old);
-  Old.replaceAllUsesWith(New(Builder));
-  Old.eraseFromParent();
-  return true;
+
+  // The functions that are not picked are copied as declarations, without
+  // reading their bodies, and then dropped.
+  ValueToValueMapTy VMap;
+  auto Mutant = CloneModule(Seed, VMap, [&](const GlobalValue *GV) {
+    return !isa<Function>(GV) || Picked.contains(GV);
+  });
+  for (auto &F : make_early_inc_range(*Mutant))
+    if (F.isDeclaration() && F.use_empty())
+      F.eraseFromParent();
+  return std::move(Mutant);
 }
-bool mutateOpcode(Instruction &I) {
-  if (auto *ICmp = dyn_cast<ICmpInst>(&I)) {
-    ICmp->setPredicate(static_cast<ICmpInst::Predicate>(randomIntNotEqual(
-        ICmpInst::FIRST_ICMP_PREDICATE, ICmpInst::LAST_ICMP_PREDICATE,
-        ICmp->getPredicate())));
-    return true;
-  }
-  if (auto *FCmp = dyn_cast<FCmpInst>(&I)) {
-    FCmp->setPredicate(static_cast<FCmpInst::Predicate>(randomIntNotEqual(
-        FCmpInst::FIRST_FCMP_PREDICATE, FCmpInst::LAST_FCMP_PREDICATE,
-        FCmp->getPredicate())));
-    return true;
-  }
-  // logical and/or <-> bitwise and/or
-  if (auto *SI = dyn_cast<SelectInst>(&I)) {
-    if (SI->getType()->isIntOrIntVectorTy(1) &&
-        SI->getType() == SI->getCondition()->getType()) {
-      if (match(SI->getTrueValue(), m_One()))
-        return createNewInst(I, [&](IRBuilder<> &Builder) {
-          return Builder.CreateOr(SI->getCondition(), SI->getFalseValue());
-        });
-
-      if (match(SI->getFalseValue(), m_Zero()))
-        return createNewInst(I, [&](IRBuilder<> &Builder) {
-          return Builder.CreateAnd(SI->getCondition(), SI->getTrueValue());
-        });
+
+static void timeIO(const Module &M) {
+  TimerGroup TG("io", "Seed I/O");
+  Timer PrintText("print-text", "Print textual IR", TG);
+  Timer WriteBC("write-bc", "Write bitcode", TG);
+  Timer ParseText("parse-text", "Parse textual IR", TG);
+  Timer ParseBC("parse-bc", "Parse bitcode", TG);
+
+  std::string Text;
+  SmallVector<char, 0> BC;
+  for (uint32_t I = 0; I != TimeIO; ++I) {
+    Text.clear();
+    BC.clear();
+    raw_string_ostream TextOS(Text);
+    raw_svector_ostream BCOS(BC);
+    {
+      TimeRegion Region(PrintText);
+      M.print(TextOS, nullptr);
+      TextOS.flush();
     }
-  }
-  if (I.getType()->isIntOrIntVectorTy(1)) {
-    if (I.getOpcode() == Instruction::And)
-      return createNewInst(I, [&](IRBuilder<> &Builder) {
-        return Builder.CreateLogicalAnd(I.getOperand(0), I.getOperand(1));
-      });
-    if (I.getOpcode() == Instruction::Or)
-      return createNewInst(I, [&](IRBuilder<> &Builder) {
-        return Builder.CreateLogicalOr(I.getOperand(0), I.getOperand(1));
-      });
-  }
-  // lshr <-> ashr
-  if (I.getOpcode() == Instruction::LShr)
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateAShr(I.getOperand(0), I.getOperand(1), I.getName(),
-                                I.isExact());
-    });
-  if (I.getOpcode() == Instruction::AShr)
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateLShr(I.getOperand(0), I.getOperand(1), I.getName(),
-                                I.isExact());
-    });
-  // sext <-> zext
-  if (I.getOpcode() == Instruction::SExt)
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateZExt(I.getOperand(0), I.getType(), I.getName());
-    });
-  if (I.getOpcode() == Instruction::ZExt)
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateSExt(I.getOperand(0), I.getType(), I.getName());
-    });
-  // and/or/xor
-  if (I.isBitwiseLogicOp())
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateBinOp(
-          static_cast<Instruction::BinaryOps>(randomIntNotEqual(
-              Instruction::And, Instruction::Xor, I.getOpcode())),
-          I.getOperand(0), I.getOperand(1), I.getName());
-    });
-  // [s|u]max/min
-  if (auto *MinMax = dyn_cast<MinMaxIntrinsic>(&I)) {
-    Intrinsic::ID IID[] = {Intrinsic::smax, Intrinsic::smin, Intrinsic::umax,
-                           Intrinsic::umin};
-    uint32_t CurrentId = 0;
-    switch (MinMax->getIntrinsicID()) {
-    case Intrinsic::smax:
-      CurrentId = 0;
-      break;
-    case Intrinsic::smin:
-      CurrentId = 1;
-      break;
-    case Intrinsic::umax:
-      CurrentId = 2;
-      break;
-    case Intrinsic::umin:
-      CurrentId = 3;
-      break;
-    default:
-      llvm_unreachable("Unexpected MinMaxIntrinsic");
+    {
+      TimeRegion Region(WriteBC);
+      WriteBitcodeToFile(M, BCOS);
     }
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateBinaryIntrinsic(
-          IID[(CurrentId + randomInt(1, 3)) % 4], MinMax->getOperand(0),
-          MinMax->getOperand(1));
-    });
   }
-  // [s|u]cmp
-  if (auto *Cmp = dyn_cast<CmpIntrinsic>(&I)) {
-    if (Cmp->isSigned())
-      return createNewInst(I, [&](IRBuilder<> &Builder) {
-        return Builder.CreateIntrinsic(
-            Cmp->getType(), Intrinsic::ucmp,
-            {Cmp->getOperand(0), Cmp->getOperand(1)});
-      });
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateIntrinsic(Cmp->getType(), Intrinsic::scmp,
-                                     {Cmp->getOperand(0), Cmp->getOperand(1)});
-    });
-  }
-  // fshl/fshr
-  if (match(&I, m_Intrinsic<Intrinsic::fshl>()) ||
-      match(&I, m_Intrinsic<Intrinsic::fshr>()))
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateIntrinsic(
-          I.getType(),
-          match(&I, m_Intrinsic<Intrinsic::fshl>()) ? Intrinsic::fshr
-                                                    : Intrinsic::fshl,
-          {I.getOperand(0), I.getOperand(1), I.getOperand(2)});
-    });
-  return false;
-}
-bool canonicalizeOp(Instruction &I) {
-  switch (I.getOpcode()) {
-  // sext -> zext nneg
-  case Instruction::SExt:
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateZExt(I.getOperand(0), I.getType(), I.getName(),
-                                /*IsNonNeg=*/true);
-    });
-  // sitofp -> uitofp nneg
-  case Instruction::SIToFP:
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      return Builder.CreateUIToFP(I.getOperand(0), I.getType(), I.getName(),
-                                  /*IsNonNeg=*/true);
-    });
-  // xor/add -> or disjoint
-  case Instruction::Xor:
-  case Instruction::Add:
-    if (I.getType()->isIntOrIntVectorTy(1))
-      break;
-    return createNewInst(I, [&](IRBuilder<> &Builder) {
-      auto *Val =
-          Builder.CreateOr(I.getOperand(0), I.getOperand(1), I.getName());
-      if (auto *Or = dyn_cast<PossiblyDisjointInst>(Val))
-        Or->setIsDisjoint(true);
-      return Val;
-    });
-  // icmp spred -> icmp samesign upred
-  case Instruction::ICmp: {
-    auto *Cmp = cast<ICmpInst>(&I);
-    if (Cmp->isUnsigned()) {
-      Cmp->setSameSign(true);
-      Cmp->setPredicate(Cmp->getUnsignedPredicate());
-      return true;
+
+  for (uint32_t I = 0; I != TimeIO; ++I) {
+    LLVMContext TextCtx, BCCtx;
+    SMDiagnostic Err;
+    std::unique_ptr<Module> TextM, BCM;
+    {
+      TimeRegion Region(ParseText);
+      TextM = parseIR(MemoryBufferRef(Text, "text"), Err, TextCtx);
     }
-    break;
-  }
-  // fcmp unordered -> fcmp nnan ordered
-  case Instruction::FCmp: {
-    auto *Cmp = cast<FCmpInst>(&I);
-    if (FCmpInst::isUnordered(Cmp->getPredicate())) {
-      Cmp->setHasNoNaNs(true);
-      Cmp->setPredicate(Cmp->getOrderedPredicate());
-      return true;
+    {
+      TimeRegion Region(ParseBC);
+      BCM = parseIR(MemoryBufferRef(StringRef(BC.data(), BC.size()), "bc"),
+                    Err, BCCtx);
     }
-    break;
-  }
-  // logical -> bitwise
-  case Instruction::Select: {
-    Value *X, *Y;
-    if (match(&I, m_LogicalAnd(m_Value(X), m_Value(Y))))
-      return createNewInst(I, [&](IRBuilder<> &Builder) {
-        return Builder.CreateAnd(X, Y, I.getName());
-      });
-    if (match(&I, m_LogicalOr(m_Value(X), m_Value(Y))))
-      return createNewInst(I, [&](IRBuilder<> &Builder) {
-        return Builder.CreateOr(X, Y, I.getName());
-      });
-    break;
+    if (!TextM || !BCM)
+      report_fatal_error("Failed to parse the printed seed");
   }
-  default:
-    break;
-  }
-  return false;
-}
-bool commuteOperands(Instruction &I) {
-  if (auto *BI = dyn_cast<CondBrInst>(&I)) {
-    BI->swapSuccessors();
-    return true;
-  }
-  if (auto *SI = dyn_cast<SelectInst>(&I)) {
-    if (match(SI, m_LogicalOp(m_Value(), m_Value())))
-      return false;
-    SI->swapValues();
-    return true;
-  }
-  if (I.getNumOperands() < 2)
-    return false;
-  if (isa<PHINode>(&I) || isa<GetElementPtrInst>(&I))
-    return false;
-  if (I.getOperand(0)->getType() != I.getOperand(1)->getType())
-    return false;
-  if (isa<CallInst>(I) && !I.isCommutative())
-    return false;
-  I.getOperandUse(0).swap(I.getOperandUse(1));
-  return true;
+
+  errs() << "Runs: " << TimeIO << ", textual IR: " << Text.size()
+         << " bytes, bitcode: " << BC.size() << " bytes\n";
 }
-bool commuteOperandsOfCommutativeInst(Instruction &I) {
-  if (I.getNumOperands() < 2)
-    return false;
-  if (auto *SI = dyn_cast<SelectInst>(&I)) {
-    if (match(SI, m_LogicalOp(m_Value(), m_Value())))
-      return false;
-    Value *X;
-    if (match(SI->getCondition(), m_Not(m_Value(X))))
-      SI->setCondition(X);
-    else if (auto *Cmp = dyn_cast<CmpInst>(SI->getCondition())) {
-      if (Cmp->hasOneUse())
-        Cmp->setPredicate(Cmp->getInversePredicate());
-      else
-        return false;
-    } else
-      return false;
-    SI->swapValues();
-    return true;
-  }
-  if (isa<Constant>(I.getOperand(1)))
-    return false;
-  if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
-    Cmp->swapOperands();
-    return true;
+
+// The mutants produced by this process, per recipe.
+static StringMap<MutantSet> SeenMutants;
+
+static void printStats(raw_ostream &OS) {
+  bool First = true;
+  for (auto &Entry : SeenMutants) {
+    const MutantSet &Seen = Entry.getValue();
+    uint64_t Attempts = Seen.Mutants + Seen.Duplicates;
+    OS << (First ? "" : " ") << Entry.getKey() << '=' << Seen.Duplicates
+       << '/' << Attempts
+       << format(" (%.1f%%)", Attempts ? 100.0 * Seen.Duplicates / Attempts
+                                       : 0.0);
+    First = false;
   }
-  if (!I.isCommutative())
-    return false;
-  I.getOperandUse(0).swap(I.getOperandUse(1));
-  return true;
 }
-std::string getTypeName(Type *Ty) {
-  if (Ty->isIntegerTy())
-    return "i" + std::to_string(Ty->getScalarSizeInBits());
-  if (Ty->isFloatTy())
-    return "f32";
-  if (Ty->isDoubleTy())
-    return "f64";
-  if (Ty->isHalfTy())
-    return "f16";
-  if (Ty->isBFloatTy())
-    return "bf16";
-  if (Ty->isPointerTy())
-    return "ptr";
-  if (auto *Vec = dyn_cast<FixedVectorType>(Ty)) {
-    auto Sub = getTypeName(Vec->getElementType());
-    if (Sub.empty())
-      return "";
-    return std::to_string(Vec->getNumElements()) + "x" + Sub;
-  }
-  return "";
+
+static MutationOptions getOptions(StringRef RecipeName,
+                                  MutationJournal *Journal) {
+  MutationOptions Opts;
+  Opts.Threads = Threads;
+  Opts.Journal = Journal;
+  if (Dedup)
+    Opts.Seen = &SeenMutants[RecipeName];
+  return Opts;
 }
-bool breakOneUse(Instruction &I) {
-  if (!I.hasOneUse())
-    return false;
-  if (!I.getType()->isSingleValueType())
-    return false;
-  if (I.isTerminator())
-    return false;
-  if (isa<PHINode>(&I))
-    return false;
-
-  auto *Ty = I.getType();
-  auto TyName = getTypeName(Ty);
-  auto *M = I.getModule();
-  auto Callee = M->getOrInsertFunction(
-      "fuzz_use_" + TyName,
-      FunctionType::get(Type::getVoidTy(M->getContext()), {Ty}, false));
-  IRBuilder<> Builder(I.getNextNode());
-  Builder.CreateCall(Callee, &I);
-  return true;
+
+static uint64_t getBaseSeed() {
+  return RngSeed.getNumOccurrences() ? RngSeed.getValue() : getRandomSeed();
 }
-bool mutateArgAttr(Argument &Arg) {
-  switch (randomUInt(1)) {
-  case 0:
-    if (Arg.getType()->isPointerTy()) {
-      if (Arg.hasNonNullAttr())
-        Arg.removeAttr(Attribute::NonNull);
-      else
-        Arg.addAttr(Attribute::NonNull);
-      return true;
-    }
-    break;
-  case 1:
-    if (Arg.hasAttribute(Attribute::NoUndef))
-      Arg.removeAttr(Attribute::NoUndef);
+
+// Returns the function mutants rejected as duplicates and made in all, counted
+// with --dedup.
+static Expected<std::pair<uint64_t, uint64_t>>
+serveRequest(Module &Seed, StringRef Request, uint64_t DefaultSeed) {
+  StringRef RecipeName, Output, SeedField, JournalPath;
+  SmallVector<StringRef> Fields;
+  Request.split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (StringRef Field : Fields) {
+    auto [Key, Value] = Field.trim(',').split('=');
+    if (Key == "recipe")
+      RecipeName = Value;
+    else if (Key == "out")
+      Output = Value;
+    else if (Key == "rng-seed")
+      SeedField = Value;
+    else if (Key == "journal")
+      JournalPath = Value;
     else
-      Arg.addAttr(Attribute::NoUndef);
-    return true;
-  }
-  return false;
-}
-bool replaceArgUse(Instruction &I) {
-  SmallVector<Use *> Uses;
-  for (auto &Op : I.operands())
-    if (isa<Argument>(Op) && !Op->hasOneUse())
-      Uses.push_back(&Op);
-  if (Uses.empty())
-    return false;
-  auto &Op = *Uses[randomUInt(Uses.size() - 1)];
-  SmallVector<Argument *> Replacements;
-  for (auto &Arg : I.getFunction()->args())
-    if (Arg.getType() == Op->getType() && &Arg != Op.get())
-      Replacements.push_back(&Arg);
-  if (Replacements.empty())
-    return false;
-  Op->replaceAllUsesWith(Replacements[randomUInt(Replacements.size() - 1)]);
-  return true;
-}
-bool insertNodes(Instruction &I) {
-  if (I.use_empty() || I.isTerminator())
-    return false;
-  Type *Ty = I.getType();
-  if (randomBool() && (Ty->isIntOrIntVectorTy() || Ty->isPtrOrPtrVectorTy() ||
-                       Ty->isFPOrFPVectorTy())) {
-    for (auto &U : I.uses()) {
-      if (isa<PHINode>(U.getUser()) || isa<FreezeInst>(U.getUser()))
-        continue;
-      if (randomBool()) {
-        IRBuilder<> Builder(cast<Instruction>(U.getUser()));
-        U.set(Builder.CreateFreeze(&I));
-        return true;
-      }
-    }
+      return createStringError(inconvertibleErrorCode(),
+                               "unknown field '" + Key + "'");
   }
 
-  if (Ty->isFPOrFPVectorTy()) {
-    for (auto &U : I.uses()) {
-      if (isa<PHINode>(U.getUser()))
-        continue;
-      if (randomBool()) {
-        IRBuilder<> Builder(cast<Instruction>(U.getUser()));
-        Value *V;
-        switch (randomUInt(1)) {
-        case 0:
-          V = Builder.CreateFNeg(&I);
-        case 1:
-          if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
-            auto IID = II->getIntrinsicID();
-            if (IID == Intrinsic::fabs)
-              return false;
-          }
-          V = Builder.CreateUnaryIntrinsic(Intrinsic::fabs, &I);
-        }
-        U.set(V);
-        return true;
-      }
-    }
-  }
-  return false;
-}
+  MutateFuncTy mutateFunc = getRecipe(RecipeName);
+  if (!mutateFunc)
+    return createStringError(inconvertibleErrorCode(),
+                             "unknown recipe '" + RecipeName + "'");
+  if (Output.empty())
+    return createStringError(inconvertibleErrorCode(), "missing out");
+  uint64_t MutantSeed = DefaultSeed;
+  if (!SeedField.empty() && SeedField.getAsInteger(0, MutantSeed))
+    return createStringError(inconvertibleErrorCode(), "invalid rng-seed");
 
-// Recipes
-bool mutateInst(Instruction &I) {
-  switch (randomUInt(6)) {
-  case 0:
-    return mutateConstant(I);
-  case 1:
-    return addFlags(I);
-  case 2:
-    return dropFlags(I);
-  case 3:
-    return mutateOpcode(I);
-  case 4:
-    return commuteOperands(I);
-  case 5:
-    return replaceArgUse(I);
-  case 6:
-    return insertNodes(I);
-  }
-  llvm_unreachable("Unreachable code");
+  auto Mutant = copySeed(Seed, MutantSeed);
+  if (!Mutant)
+    return Mutant.takeError();
+  MutationJournal Journal;
+  MutationOptions Opts =
+      getOptions(RecipeName, JournalPath.empty() ? nullptr : &Journal);
+  auto Count = [&]() -> std::pair<uint64_t, uint64_t> {
+    if (!Opts.Seen)
+      return {0, 0};
+    return {Opts.Seen->Duplicates, Opts.Seen->Mutants + Opts.Seen->Duplicates};
+  };
+  auto [DuplicatesBefore, MadeBefore] = Count();
+  mutateModule(**Mutant, mutateFunc, MutantSeed, Opts);
+  auto [DuplicatesAfter, MadeAfter] = Count();
+  if (!writeModule(**Mutant, Output, EmitBitcode))
+    return createStringError(inconvertibleErrorCode(),
+                             "cannot write " + Output);
+  if (!JournalPath.empty() &&
+      !writeJournal(Journal, JournalPath, {Sample, MutantSeed}))
+    return createStringError(inconvertibleErrorCode(),
+                             "cannot write " + JournalPath);
+  return std::make_pair(DuplicatesAfter - DuplicatesBefore,
+                        MadeAfter - MadeBefore);
 }
-constexpr uint32_t MaxIterFactor = 100;
-
-bool correctnessCheck(Function &F) {
-  uint32_t MutationCount = randomInt(1, 5);
-  uint32_t MutationIter = 0;
-  uint32_t MaxIter = MutationCount * MaxIterFactor;
-
-  for (uint32_t I = 0; I < MaxIter; ++I) {
-    uint32_t Size = F.arg_size();
-    for (auto &BB : F)
-      Size += BB.size();
-    uint32_t Pos = randomUInt(Size - 1);
-    uint32_t Idx = 0;
-
-    for (auto &Arg : F.args())
-      if ((Idx++ == Pos) && mutateArgAttr(Arg)) {
-        if (++MutationIter == MutationCount)
-          return true;
-      }
-    for (auto &BB : F) {
-      for (auto &I : make_early_inc_range(BB)) {
-        if ((Idx++ == Pos) && mutateInst(I)) {
-          if (++MutationIter == MutationCount)
-            return true;
-        }
-      }
+
+static int serve() {
+  std::unique_ptr<LLVMContext> Ctx;
+  std::unique_ptr<Module> Seed;
+  uint32_t Served = 0;
+  uint64_t NextSeed = getBaseSeed();
+
+  for (std::string Line; std::getline(std::cin, Line);) {
+    if (StringRef(Line).trim().empty())
+      continue;
+    if (StringRef(Line).trim() == "stats") {
+      outs() << "stats ";
+      printStats(outs());
+      outs() << '\n';
+      outs().flush();
+      continue;
     }
-  }
-  return MutationIter != 0;
-}
 
-bool mutateOnce(Function &F, bool (*Mutator)(Instruction &)) {
-  for (uint32_t I = 0; I < MaxIterFactor; ++I) {
-    uint32_t Size = F.arg_size();
-    for (auto &BB : F)
-      Size += BB.size();
-    uint32_t Pos = randomUInt(Size - 1);
-    uint32_t Idx = 0;
-
-    for (auto &BB : F) {
-      for (auto &I : BB) {
-        if ((Idx++ == Pos) && Mutator(I)) {
-          return true;
-        }
-      }
+    // Types and uniqued constants created by previous mutants are owned by
+    // the context and never freed, so start over with a fresh one from time
+    // to time.
+    if (!Seed || Served == RecycleAfter) {
+      Seed.reset();
+      Ctx = std::make_unique<LLVMContext>();
+      Seed = loadSeed(*Ctx, /*Lazy=*/Sample != 0);
+      if (!Seed)
+        return EXIT_FAILURE;
+      Served = 0;
     }
+    ++Served;
+
+    auto Duplicates = serveRequest(*Seed, StringRef(Line).trim(), NextSeed++);
+    if (!Duplicates)
+      outs() << "error " << toString(Duplicates.takeError()) << '\n';
+    else if (Dedup)
+      outs() << "ok duplicates=" << Duplicates->first << '/'
+             << Duplicates->second << '\n';
+    else
+      outs() << "ok\n";
+    outs().flush();
   }
-  return false;
-}
 
-bool commutativeCheck(Function &F) {
-  return mutateOnce(F, commuteOperandsOfCommutativeInst);
+  if (Dedup) {
+    errs() << "Duplicates: ";
+    printStats(errs());
+    errs() << '\n';
+  }
+  return EXIT_SUCCESS;
 }
-bool multiUseCheck(Function &F) { return mutateOnce(F, breakOneUse); }
-bool flagPreservingCheck(Function &F) { return mutateOnce(F, addFlags); }
-// TODO: remove noundef/nonnull on args
-bool flagDroppingCheck(Function &F) { return mutateOnce(F, dropFlags); }
-bool canonicalFormCheck(Function &F) { return mutateOnce(F, canonicalizeOp); }
 
 int main(int argc, char **argv) {
   InitLLVM Init{argc, argv};
   cl::ParseCommandLineOptions(argc, argv, "mutate\n");
 
-  LLVMContext Ctx;
-  SMDiagnostic Err;
-  auto M = parseIRFile(SeedFile, Err, Ctx);
-  if (!M) {
-    Err.print(argv[0], errs());
-    return EXIT_FAILURE;
+  if (Serve)
+    return serve();
+
+  if (TimeIO) {
+    LLVMContext Ctx;
+    auto M = loadSeed(Ctx);
+    if (!M)
+      return EXIT_FAILURE;
+    timeIO(*M);
+    return EXIT_SUCCESS;
   }
 
-  if (M->empty())
+  if (!ReplayFile.empty()) {
+    if (OutputFile.empty()) {
+      errs() << "<output> is required\n";
+      return EXIT_FAILURE;
+    }
+    JournalSample JSample;
+    auto Journal = readJournal(ReplayFile, &JSample);
+    if (!Journal) {
+      errs() << toString(Journal.takeError()) << '\n';
+      return EXIT_FAILURE;
+    }
+    LLVMContext Ctx;
+    auto M = loadSeed(Ctx, /*Lazy=*/JSample.Count != 0);
+    if (!M)
+      return EXIT_FAILURE;
+    // A mutant of a sample lacks the functions that were not picked and the
+    // declarations only they used, so rebuild the same sample first.
+    if (JSample.Count) {
+      auto Copy = copySeed(*M, JSample.Seed, JSample.Count);
+      if (!Copy) {
+        errs() << toString(Copy.takeError()) << '\n';
+        return EXIT_FAILURE;
+      }
+      M = std::move(*Copy);
+    }
+    if (Error E = replayJournal(*M, *Journal, ReplayEdits)) {
+      errs() << toString(std::move(E)) << '\n';
+      return EXIT_FAILURE;
+    }
+    return writeModule(*M, OutputFile, EmitBitcode) ? EXIT_SUCCESS
+                                                    : EXIT_FAILURE;
+  }
+
+  if (OutputFile.empty() || Recipe.empty()) {
+    errs() << "<output> and <recipe> are required\n";
     return EXIT_FAILURE;
+  }
 
-  SmallVector<Function *> Funcs;
-  for (auto &F : *M)
-    if (!F.isDeclaration())
-      Funcs.push_back(&F);
+  auto IsPattern = [](StringRef Path) {
+    return Path.find("%d") != StringRef::npos;
+  };
+  if (Count == 0 || (Count > 1 && (!IsPattern(OutputFile) ||
+                                   (!JournalFile.empty() &&
+                                    !IsPattern(JournalFile))))) {
+    errs() << "--count=N requires output and journal patterns containing "
+              "'%d'\n";
+    return EXIT_FAILURE;
+  }
 
-  if (Funcs.empty())
+  LLVMContext Ctx;
+  auto M = loadSeed(Ctx, /*Lazy=*/Sample != 0);
+  if (!M)
     return EXIT_FAILURE;
 
-  bool (*mutateFunc)(Function &F) = nullptr;
-  if (Recipe == "correctness")
-    mutateFunc = correctnessCheck;
-  else if (Recipe == "commutative")
-    mutateFunc = commutativeCheck;
-  else if (Recipe == "multi-use")
-    mutateFunc = multiUseCheck;
-  else if (Recipe == "flag-preserving")
-    mutateFunc = flagPreservingCheck;
-  else if (Recipe == "flag-dropping")
-    mutateFunc = flagDroppingCheck;
-  else if (Recipe == "canonical-form")
-    mutateFunc = canonicalFormCheck;
-  else {
+  MutateFuncTy mutateFunc = getRecipe(Recipe);
+  if (!mutateFunc) {
     errs() << "Unknown recipe " << Recipe << "\n";
     return EXIT_FAILURE;
   }
 
-  SmallVector<Function *> ErasedFuncs;
-  for (auto &Func : Funcs) {
-    if (!mutateFunc(*Func)) {
-      ErasedFuncs.push_back(Func);
+  // The seed is parsed only once. Each mutant is produced from a fresh clone
+  // so that the seed itself is never modified.
+  uint64_t BaseSeed = getBaseSeed();
+  for (uint32_t Idx = 0; Idx != Count; ++Idx) {
+    std::unique_ptr<Module> Mutant;
+    if (!Sample && Idx + 1 == Count) {
+      Mutant = std::move(M);
+    } else if (auto Copy = copySeed(*M, BaseSeed + Idx)) {
+      Mutant = std::move(*Copy);
+    } else {
+      errs() << toString(Copy.takeError()) << '\n';
+      return EXIT_FAILURE;
     }
+    MutationJournal Journal;
+    mutateModule(*Mutant, mutateFunc, BaseSeed + Idx,
+                 getOptions(Recipe, JournalFile.empty() ? nullptr : &Journal));
+    if (!writeModule(*Mutant, expandPattern(OutputFile, Idx), EmitBitcode))
+      return EXIT_FAILURE;
+    if (!JournalFile.empty() &&
+        !writeJournal(Journal, expandPattern(JournalFile, Idx),
+                      {Sample, BaseSeed + Idx}))
+      return EXIT_FAILURE;
   }
-  for (auto *Func : ErasedFuncs) {
-    Func->replaceAllUsesWith(PoisonValue::get(Func->getType()));
-    Func->eraseFromParent();
-  }
-
-  // if (verifyModule(*M, &errs()))
-  //   return EXIT_FAILURE;
 
-  std::error_code EC;
-  raw_fd_ostream OS(OutputFile, EC, sys::fs::OF_Text);
-  if (EC) {
-    errs() << "Error opening file: " << EC.message() << '\n';
-    return EXIT_FAILURE;
+  if (Dedup) {
+    errs() << "Duplicates: ";
+    printStats(errs());
+    errs() << '\n';
   }
-  M->print(OS, nullptr);
-
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,1620 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "mutator.h"
+#include "fingerprint.h"
+#include <llvm/ADT/APFloat.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Analysis/InstructionSimplify.h>
+#include <llvm/IR/Argument.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constant.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GEPNoWrapFlags.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InstVisitor.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/IR/PatternMatch.h>
+#include <llvm/IR/Type.h>
+#include <llvm/IR/Value.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <array>
+#include <numeric>
+#include <random>
+#include <string>
+
+using namespace llvm;
+using namespace PatternMatch;
+
+// A splitmix64 generator. Unlike std::mt19937_64 with the std
+// distributions, its output is fully specified, so a mutant is reproduced bit
+// for bit from its seed on any platform. split(Key) derives an independent
+// stream, which is how each function, attempt and mutation gets its own.
+class RandomStream {
+  uint64_t State;
+
+public:
+  explicit RandomStream(uint64_t Seed) : State(Seed) {}
+  static uint64_t mix(uint64_t Z) {
+    Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+    return Z ^ (Z >> 31);
+  }
+  uint64_t operator()() { return mix(State += 0x9e3779b97f4a7c15ULL); }
+  RandomStream split(uint64_t Key) const {
+    return RandomStream(mix(State ^ mix(Key + 0x9e3779b97f4a7c15ULL)));
+  }
+  // Returns a uniform value in [0, Bound) without modulo bias (Lemire).
+  uint64_t bounded(uint64_t Bound) {
+    uint64_t Threshold = -Bound % Bound;
+    while (true) {
+      unsigned __int128 Product = (unsigned __int128)(*this)() * Bound;
+      if (static_cast<uint64_t>(Product) >= Threshold)
+        return static_cast<uint64_t>(Product >> 64);
+    }
+  }
+};
+
+// Each thread mutates with its own stream. mutateFunction reseeds it for every
+// attempt.
+thread_local RandomStream Gen(0);
+uint64_t getRandomSeed() {
+  std::random_device RD;
+  return (uint64_t(RD()) << 32) | RD();
+}
+std::vector<uint32_t> sampleIndices(uint32_t Size, uint32_t Count,
+                                    uint64_t Seed) {
+  std::vector<uint32_t> Indices(Size);
+  std::iota(Indices.begin(), Indices.end(), 0);
+  Count = std::min(Count, Size);
+  RandomStream Stream(Seed);
+  for (uint32_t I = 0; I != Count; ++I)
+    std::swap(Indices[I], Indices[I + Stream.bounded(Size - I)]);
+  Indices.resize(Count);
+  llvm::sort(Indices);
+  return Indices;
+}
+bool randomBool() { return Gen() >> 63; }
+uint32_t randomUInt(uint32_t Max) {
+  return static_cast<uint32_t>(Gen.bounded(uint64_t(Max) + 1));
+}
+int32_t randomInt(int32_t Min, int32_t Max) {
+  return static_cast<int32_t>(
+      int64_t(Min) + int64_t(Gen.bounded(uint64_t(int64_t(Max) - Min + 1))));
+}
+int32_t randomIntNotEqual(int32_t Min, int32_t Max, int32_t NotEqual) {
+  while (true) {
+    int32_t Value = randomInt(Min, Max);
+    if (Value != NotEqual)
+      return Value;
+  }
+}
+enum MutatorKind : uint32_t {
+  MK_Constant,
+  MK_AddFlags,
+  MK_DropFlags,
+  MK_Opcode,
+  MK_Commute,
+  MK_ReplaceArgUse,
+  MK_InsertNodes,
+  MK_CommuteCommutative,
+  MK_BreakOneUse,
+  MK_Canonicalize,
+  MK_ArgAttr,
+  MK_Count
+};
+// Names used for the mutators in journals, indexed by MutatorKind.
+static const char *const MutatorNames[MK_Count] = {
+    "constant",
+    "add-flags",
+    "drop-flags",
+    "opcode",
+    "commute",
+    "replace-arg-use",
+    "insert-nodes",
+    "commute-commutative",
+    "break-one-use",
+    "canonicalize",
+    "arg-attr",
+};
+// Mutators that correctnessCheck picks from for instructions.
+constexpr uint32_t NumInstMutatorsForCorrectness = MK_InsertNodes + 1;
+
+uint32_t getApplicableMutators(Instruction &I);
+
+// A flat index of the mutation sites (arguments and instructions) of a
+// function. Each site records the mutators that may apply to it, and each
+// mutator keeps the positions of its sites. Picking a site for a mutator is
+// therefore O(1) and never lands on a site the mutator ignores.
+// The index is built once per function. createNewInst hands the position of
+// an instruction it replaces to the new one, and update brings the index up
+// to date after every edit.
+class MutationSiteIndex {
+  struct Site {
+    Value *V;
+    uint32_t Mask;
+  };
+  std::vector<Site> Sites;
+  DenseMap<Value *, uint32_t> Positions;
+  std::array<std::vector<uint32_t>, MK_Count> SitesOf;
+
+  void addSite(Value *V, uint32_t Mask);
+  void setMask(uint32_t Pos, uint32_t Mask);
+
+public:
+  explicit MutationSiteIndex(Function &F);
+
+  // Returns a random site that Kind may apply to, or nullptr if there is no
+  // such site.
+  Value *pick(MutatorKind Kind);
+  // Adds the instructions an edit created (e.g. by insertNodes or
+  // breakOneUse) and recomputes the mutators of all others, as an edit may
+  // also change what applies to the users and operands of what it touched.
+  // This scans F, which only successful edits pay for, at most a few per
+  // function.
+  void update(Function &F);
+  // Old has been replaced with New, which takes over its position.
+  void replace(Instruction &Old, Value *New);
+};
+
+// The index of the function being mutated, if any.
+thread_local MutationSiteIndex *CurrentIndex = nullptr;
+// The journal the edits of the current thread are recorded in, if any.
+thread_local MutationJournal *CurrentJournal = nullptr;
+
+// Mutators
+
+bool mutateConstant(Instruction &I) {
+  if (isa<GetElementPtrInst>(I) || isa<SwitchInst>(I) ||
+      match(&I, m_Intrinsic<Intrinsic::is_fpclass>()) || isa<PHINode>(I))
+    return false;
+  for (auto &Op : I.operands()) {
+    if (!isa<Constant>(Op.get()))
+      continue;
+    if (randomBool())
+      continue;
+    const APInt *C;
+    if (match(Op.get(), m_APInt(C))) {
+      if (I.isShift() && &Op == &I.getOperandUse(1)) {
+        Op.set(ConstantInt::get(
+            Op->getType(),
+            APInt(C->getBitWidth(), randomUInt(C->getBitWidth() - 1))));
+        return true;
+      }
+      if (I.getOpcode() == Instruction::ExtractElement &&
+          &Op == &I.getOperandUse(1)) {
+        Op.set(ConstantInt::get(
+            Op->getType(),
+            APInt(C->getBitWidth(),
+                  randomUInt(cast<VectorType>(I.getOperand(0)->getType())
+                                 ->getElementCount()
+                                 .getKnownMinValue() -
+                             1))));
+        return true;
+      }
+      if (I.getOpcode() == Instruction::ExtractValue &&
+          &Op == &I.getOperandUse(1)) {
+        Type *SrcTy = I.getOperand(0)->getType();
+        Op.set(ConstantInt::get(
+            Op->getType(),
+            APInt(C->getBitWidth(),
+                  randomUInt((SrcTy->isStructTy()
+                                  ? SrcTy->getStructNumElements()
+                                  : SrcTy->getArrayNumElements()) -
+                             1))));
+        return true;
+      }
+
+      switch (randomUInt(3)) {
+      case 0: {
+        // Special values
+        switch (randomUInt(4)) {
+        case 0:
+          Op.set(ConstantInt::get(Op->getType(), 0));
+          break;
+        case 1:
+          Op.set(ConstantInt::get(Op->getType(), 1));
+          break;
+        case 2:
+          Op.set(ConstantInt::get(Op->getType(), -1, /*IsSigned=*/true));
+          break;
+        case 3:
+          Op.set(ConstantInt::get(Op->getType(),
+                                  APInt::getSignedMaxValue(C->getBitWidth())));
+          break;
+        case 4:
+          Op.set(ConstantInt::get(Op->getType(),
+                                  APInt::getSignedMinValue(C->getBitWidth())));
+          break;
+        }
+        break;
+      }
+      case 1: {
+        // Negate
+        Op.set(ConstantInt::get(Op->getType(), -(*C)));
+        break;
+      }
+      case 2: {
+        // Inversion
+        Op.set(ConstantInt::get(Op->getType(), ~(*C)));
+        break;
+      }
+      case 3: {
+        // Random value
+        if (C->getBitWidth() < 64)
+          return false;
+        Op.set(ConstantInt::get(Op->getType(), APInt(C->getBitWidth(), Gen())));
+        break;
+      }
+      }
+      return true;
+    }
+    const APFloat *F;
+    if (match(Op.get(), m_APFloat(F))) {
+      APFloat New = *F;
+      switch (randomUInt(4)) {
+      case 0:
+        New.changeSign();
+        break;
+      case 1:
+        New.next(true);
+        break;
+      case 2:
+        New.next(false);
+        break;
+      case 3: {
+        uint64_t Raw = Gen();
+        unsigned BitWidth = APFloat::getSizeInBits(New.getSemantics());
+        New = APFloat(New.getSemantics(), APInt(BitWidth, Raw, false, true));
+        break;
+      }
+      case 4: {
+        switch (randomUInt(5)) {
+        case 0:
+          New = APFloat::getZero(New.getSemantics());
+          break;
+        case 1:
+          New = APFloat::getInf(New.getSemantics());
+          break;
+        case 2:
+          New = APFloat::getQNaN(New.getSemantics());
+          break;
+        case 3:
+          New = APFloat::getSmallest(New.getSemantics());
+          break;
+        case 4:
+          New = APFloat::getLargest(New.getSemantics());
+          break;
+        case 5:
+          New = APFloat::getSmallestNormalized(New.getSemantics());
+          break;
+        }
+        if (randomBool())
+          New.changeSign();
+        break;
+      }
+      }
+      if (New.bitwiseIsEqual(*F))
+        return false;
+      Op.set(ConstantFP::get(Op->getType(), New));
+      return true;
+    }
+  }
+  return false;
+}
+bool mutateFlags(Instruction &I, bool Add) {
+  if (auto *OBO = dyn_cast<OverflowingBinaryOperator>(&I)) {
+    if (Add) {
+      if (randomBool()) {
+        if (!OBO->hasNoUnsignedWrap()) {
+          I.setHasNoUnsignedWrap();
+          return true;
+        }
+      } else {
+        if (!OBO->hasNoSignedWrap()) {
+          I.setHasNoSignedWrap();
+          return true;
+        }
+      }
+    } else {
+      if (randomBool()) {
+        if (OBO->hasNoUnsignedWrap()) {
+          I.setHasNoUnsignedWrap(false);
+          return true;
+        }
+      } else {
+        if (OBO->hasNoSignedWrap()) {
+          I.setHasNoSignedWrap(false);
+          return true;
+        }
+      }
+    }
+  }
+  if (auto *Exact = dyn_cast<PossiblyExactOperator>(&I)) {
+    if (Add) {
+      if (!Exact->isExact()) {
+        I.setIsExact();
+        return true;
+      }
+    } else {
+      if (Exact->isExact()) {
+        I.setIsExact(false);
+        return true;
+      }
+    }
+  }
+  if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+    if (Add) {
+      switch (randomUInt(2)) {
+      case 0:
+        if (!GEP->isInBounds()) {
+          GEP->setIsInBounds(true);
+          return true;
+        }
+        break;
+      case 1:
+        if (!GEP->getNoWrapFlags().hasNoUnsignedWrap()) {
+          GEP->setNoWrapFlags(GEP->getNoWrapFlags() |
+                              GEPNoWrapFlags::noUnsignedWrap());
+          return true;
+        }
+        break;
+      case 2:
+        if (!GEP->getNoWrapFlags().hasNoUnsignedSignedWrap()) {
+          GEP->setNoWrapFlags(GEP->getNoWrapFlags() |
+                              GEPNoWrapFlags::noUnsignedSignedWrap());
+          return true;
+        }
+        break;
+      }
+    } else {
+      switch (randomUInt(2)) {
+      case 0:
+        if (GEP->isInBounds()) {
+          GEP->setIsInBounds(false);
+          return true;
+        }
+        break;
+      case 1:
+        if (GEP->getNoWrapFlags().hasNoUnsignedWrap()) {
+          GEP->setNoWrapFlags(GEP->getNoWrapFlags().withoutNoUnsignedWrap());
+          return true;
+        }
+        break;
+      case 2:
+        if (GEP->getNoWrapFlags().hasNoUnsignedSignedWrap()) {
+          GEP->setNoWrapFlags(
+              GEP->getNoWrapFlags().withoutNoUnsignedSignedWrap());
+          return true;
+        }
+        break;
+      }
+    }
+  }
+  if (auto *Trunc = dyn_cast<TruncInst>(&I)) {
+    if (Add) {
+      if (randomBool()) {
+        if (!Trunc->hasNoUnsignedWrap()) {
+          I.setHasNoUnsignedWrap();
+          return true;
+        }
+      } else {
+        if (!Trunc->hasNoSignedWrap()) {
+          I.setHasNoSignedWrap();
+          return true;
+        }
+      }
+    } else {
+      if (randomBool()) {
+        if (Trunc->hasNoUnsignedWrap()) {
+          I.setHasNoUnsignedWrap(false);
+          return true;
+        }
+      } else {
+        if (Trunc->hasNoSignedWrap()) {
+          I.setHasNoSignedWrap(false);
+          return true;
+        }
+      }
+    }
+  }
+  if (auto *Disjoint = dyn_cast<PossiblyDisjointInst>(&I)) {
+    if (Add) {
+      if (!Disjoint->isDisjoint()) {
+        Disjoint->setIsDisjoint(true);
+        return true;
+      }
+    } else {
+      if (Disjoint->isDisjoint()) {
+        Disjoint->setIsDisjoint(false);
+        return true;
+      }
+    }
+  }
+  if (auto *NNeg = dyn_cast<PossiblyNonNegInst>(&I)) {
+    if (Add) {
+      if (!NNeg->hasNonNeg()) {
+        NNeg->setNonNeg();
+        return true;
+      }
+    } else {
+      if (NNeg->hasNonNeg()) {
+        NNeg->setNonNeg(false);
+        return true;
+      }
+    }
+  }
+  if (auto *ICmp = dyn_cast<ICmpInst>(&I)) {
+    if (Add) {
+      if (!ICmp->hasSameSign()) {
+        ICmp->setSameSign();
+        return true;
+      }
+    } else {
+      if (ICmp->hasSameSign()) {
+        ICmp->setSameSign(false);
+        return true;
+      }
+    }
+  }
+  if (auto *FPOp = dyn_cast<FPMathOperator>(&I)) {
+    if (Add) {
+      switch (randomUInt(1)) {
+      case 0:
+        if (!FPOp->hasNoInfs()) {
+          I.setHasNoInfs(true);
+          return true;
+        }
+        break;
+      case 1:
+        if (!FPOp->hasNoNaNs()) {
+          I.setHasNoNaNs(true);
+          return true;
+        }
+        break;
+        // case 2:
+        //   if (!FPOp->hasNoSignedZeros()) {
+        //     // See
+        //     //
+        //     https://discourse.llvm.org/t/rfc-clarify-the-behavior-of-fp-operations-on-bit-strings-with-nsz-flag/85981
+        //     if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+        //       auto IID = II->getIntrinsicID();
+        //       if (IID == Intrinsic::fabs || IID == Intrinsic::copysign)
+        //         return false;
+        //     }
+        //     if (I.getOpcode() == Instruction::FNeg ||
+        //         I.getOpcode() == Instruction::Select)
+        //       return false;
+        //     I.setHasNoSignedZeros(true);
+        //     return true;
+        //   }
+        //   break;
+      }
+    } else {
+      switch (randomUInt(2)) {
+      case 0:
+        if (FPOp->hasNoInfs()) {
+          I.setHasNoInfs(false);
+          return true;
+        }
+        break;
+      case 1:
+        if (FPOp->hasNoNaNs()) {
+          I.setHasNoNaNs(false);
+          return true;
+        }
+        break;
+      case 2:
+        if (FPOp->hasNoSignedZeros()) {
+          I.setHasNoSignedZeros(false);
+          return true;
+        }
+        break;
+      }
+    }
+  }
+  if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+    if (II->getType()->isIntOrIntVectorTy() && randomBool()) {
+      // ret attr
+      if (Add) {
+        if (!II->hasRetAttr(Attribute::NoUndef)) {
+          II->addRetAttr(Attribute::NoUndef);
+          return true;
+        }
+      } else {
+        if (II->hasRetAttr(Attribute::NoUndef)) {
+          II->removeRetAttr(Attribute::NoUndef);
+          return true;
+        }
+      }
+    } else {
+      switch (II->getIntrinsicID()) {
+      case Intrinsic::abs:
+      case Intrinsic::ctlz:
+      case Intrinsic::cttz:
+        if (Add == cast<Constant>(II->getArgOperand(1))->isNullValue()) {
+          II->setArgOperand(
+              1, ConstantInt::getBool(II->getArgOperand(1)->getType(), Add));
+          return true;
+        }
+      default:
+        break;
+      }
+    }
+  }
+  return false;
+}
+bool addFlags(Instruction &I) { return mutateFlags(I, /*Add=*/true); }
+bool dropFlags(Instruction &I) { return mutateFlags(I, /*Add=*/false); }
+bool createNewInst(Instruction &Old, function_ref<Value *(IRBuilder<> &)> New) {
+  IRBuilder<> Builder(&Old);
+  Value *NewV = New(Builder);
+  Old.replaceAllUsesWith(NewV);
+  if (CurrentIndex)
+    CurrentIndex->replace(Old, NewV);
+  Old.eraseFromParent();
+  return true;
+}
+bool mutateOpcode(Instruction &I) {
+  if (auto *ICmp = dyn_cast<ICmpInst>(&I)) {
+    ICmp->setPredicate(static_cast<ICmpInst::Predicate>(randomIntNotEqual(
+        ICmpInst::FIRST_ICMP_PREDICATE, ICmpInst::LAST_ICMP_PREDICATE,
+        ICmp->getPredicate())));
+    return true;
+  }
+  if (auto *FCmp = dyn_cast<FCmpInst>(&I)) {
+    FCmp->setPredicate(static_cast<FCmpInst::Predicate>(randomIntNotEqual(
+        FCmpInst::FIRST_FCMP_PREDICATE, FCmpInst::LAST_FCMP_PREDICATE,
+        FCmp->getPredicate())));
+    return true;
+  }
+  // logical and/or <-> bitwise and/or
+  if (auto *SI = dyn_cast<SelectInst>(&I)) {
+    if (SI->getType()->isIntOrIntVectorTy(1) &&
+        SI->getType() == SI->getCondition()->getType()) {
+      if (match(SI->getTrueValue(), m_One()))
+        return createNewInst(I, [&](IRBuilder<> &Builder) {
+          return Builder.CreateOr(SI->getCondition(), SI->getFalseValue());
+        });
+
+      if (match(SI->getFalseValue(), m_Zero()))
+        return createNewInst(I, [&](IRBuilder<> &Builder) {
+          return Builder.CreateAnd(SI->getCondition(), SI->getTrueValue());
+        });
+    }
+  }
+  if (I.getType()->isIntOrIntVectorTy(1)) {
+    if (I.getOpcode() == Instruction::And)
+      return createNewInst(I, [&](IRBuilder<> &Builder) {
+        return Builder.CreateLogicalAnd(I.getOperand(0), I.getOperand(1));
+      });
+    if (I.getOpcode() == Instruction::Or)
+      return createNewInst(I, [&](IRBuilder<> &Builder) {
+        return Builder.CreateLogicalOr(I.getOperand(0), I.getOperand(1));
+      });
+  }
+  // lshr <-> ashr
+  if (I.getOpcode() == Instruction::LShr)
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateAShr(I.getOperand(0), I.getOperand(1), I.getName(),
+                                I.isExact());
+    });
+  if (I.getOpcode() == Instruction::AShr)
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateLShr(I.getOperand(0), I.getOperand(1), I.getName(),
+                                I.isExact());
+    });
+  // sext <-> zext
+  if (I.getOpcode() == Instruction::SExt)
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateZExt(I.getOperand(0), I.getType(), I.getName());
+    });
+  if (I.getOpcode() == Instruction::ZExt)
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateSExt(I.getOperand(0), I.getType(), I.getName());
+    });
+  // and/or/xor
+  if (I.isBitwiseLogicOp())
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateBinOp(
+          static_cast<Instruction::BinaryOps>(randomIntNotEqual(
+              Instruction::And, Instruction::Xor, I.getOpcode())),
+          I.getOperand(0), I.getOperand(1), I.getName());
+    });
+  // [s|u]max/min
+  if (auto *MinMax = dyn_cast<MinMaxIntrinsic>(&I)) {
+    Intrinsic::ID IID[] = {Intrinsic::smax, Intrinsic::smin, Intrinsic::umax,
+                           Intrinsic::umin};
+    uint32_t CurrentId = 0;
+    switch (MinMax->getIntrinsicID()) {
+    case Intrinsic::smax:
+      CurrentId = 0;
+      break;
+    case Intrinsic::smin:
+      CurrentId = 1;
+      break;
+    case Intrinsic::umax:
+      CurrentId = 2;
+      break;
+    case Intrinsic::umin:
+      CurrentId = 3;
+      break;
+    default:
+      llvm_unreachable("Unexpected MinMaxIntrinsic");
+    }
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateBinaryIntrinsic(
+          IID[(CurrentId + randomInt(1, 3)) % 4], MinMax->getOperand(0),
+          MinMax->getOperand(1));
+    });
+  }
+  // [s|u]cmp
+  if (auto *Cmp = dyn_cast<CmpIntrinsic>(&I)) {
+    if (Cmp->isSigned())
+      return createNewInst(I, [&](IRBuilder<> &Builder) {
+        return Builder.CreateIntrinsic(
+            Cmp->getType(), Intrinsic::ucmp,
+            {Cmp->getOperand(0), Cmp->getOperand(1)});
+      });
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateIntrinsic(Cmp->getType(), Intrinsic::scmp,
+                                     {Cmp->getOperand(0), Cmp->getOperand(1)});
+    });
+  }
+  // fshl/fshr
+  if (match(&I, m_Intrinsic<Intrinsic::fshl>()) ||
+      match(&I, m_Intrinsic<Intrinsic::fshr>()))
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateIntrinsic(
+          I.getType(),
+          match(&I, m_Intrinsic<Intrinsic::fshl>()) ? Intrinsic::fshr
+                                                    : Intrinsic::fshl,
+          {I.getOperand(0), I.getOperand(1), I.getOperand(2)});
+    });
+  return false;
+}
+bool canonicalizeOp(Instruction &I) {
+  switch (I.getOpcode()) {
+  // sext -> zext nneg
+  case Instruction::SExt:
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateZExt(I.getOperand(0), I.getType(), I.getName(),
+                                /*IsNonNeg=*/true);
+    });
+  // sitofp -> uitofp nneg
+  case Instruction::SIToFP:
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      return Builder.CreateUIToFP(I.getOperand(0), I.getType(), I.getName(),
+                                  /*IsNonNeg=*/true);
+    });
+  // xor/add -> or disjoint
+  case Instruction::Xor:
+  case Instruction::Add:
+    if (I.getType()->isIntOrIntVectorTy(1))
+      break;
+    return createNewInst(I, [&](IRBuilder<> &Builder) {
+      auto *Val =
+          Builder.CreateOr(I.getOperand(0), I.getOperand(1), I.getName());
+      if (auto *Or = dyn_cast<PossiblyDisjointInst>(Val))
+        Or->setIsDisjoint(true);
+      return Val;
+    });
+  // icmp spred -> icmp samesign upred
+  case Instruction::ICmp: {
+    auto *Cmp = cast<ICmpInst>(&I);
+    if (Cmp->isUnsigned()) {
+      Cmp->setSameSign(true);
+      Cmp->setPredicate(Cmp->getUnsignedPredicate());
+      return true;
+    }
+    break;
+  }
+  // fcmp unordered -> fcmp nnan ordered
+  case Instruction::FCmp: {
+    auto *Cmp = cast<FCmpInst>(&I);
+    if (FCmpInst::isUnordered(Cmp->getPredicate())) {
+      Cmp->setHasNoNaNs(true);
+      Cmp->setPredicate(Cmp->getOrderedPredicate());
+      return true;
+    }
+    break;
+  }
+  // logical -> bitwise
+  case Instruction::Select: {
+    Value *X, *Y;
+    if (match(&I, m_LogicalAnd(m_Value(X), m_Value(Y))))
+      return createNewInst(I, [&](IRBuilder<> &Builder) {
+        return Builder.CreateAnd(X, Y, I.getName());
+      });
+    if (match(&I, m_LogicalOr(m_Value(X), m_Value(Y))))
+      return createNewInst(I, [&](IRBuilder<> &Builder) {
+        return Builder.CreateOr(X, Y, I.getName());
+      });
+    break;
+  }
+  default:
+    break;
+  }
+  return false;
+}
+bool commuteOperands(Instruction &I) {
+  if (auto *BI = dyn_cast<CondBrInst>(&I)) {
+    BI->swapSuccessors();
+    return true;
+  }
+  if (auto *SI = dyn_cast<SelectInst>(&I)) {
+    if (match(SI, m_LogicalOp(m_Value(), m_Value())))
+      return false;
+    SI->swapValues();
+    return true;
+  }
+  if (I.getNumOperands() < 2)
+    return false;
+  if (isa<PHINode>(&I) || isa<GetElementPtrInst>(&I))
+    return false;
+  if (I.getOperand(0)->getType() != I.getOperand(1)->getType())
+    return false;
+  if (isa<CallInst>(I) && !I.isCommutative())
+    return false;
+  I.getOperandUse(0).swap(I.getOperandUse(1));
+  return true;
+}
+bool commuteOperandsOfCommutativeInst(Instruction &I) {
+  if (I.getNumOperands() < 2)
+    return false;
+  if (auto *SI = dyn_cast<SelectInst>(&I)) {
+    if (match(SI, m_LogicalOp(m_Value(), m_Value())))
+      return false;
+    Value *X;
+    if (match(SI->getCondition(), m_Not(m_Value(X))))
+      SI->setCondition(X);
+    else if (auto *Cmp = dyn_cast<CmpInst>(SI->getCondition())) {
+      if (Cmp->hasOneUse())
+        Cmp->setPredicate(Cmp->getInversePredicate());
+      else
+        return false;
+    } else
+      return false;
+    SI->swapValues();
+    return true;
+  }
+  if (isa<Constant>(I.getOperand(1)))
+    return false;
+  if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+    Cmp->swapOperands();
+    return true;
+  }
+  if (!I.isCommutative())
+    return false;
+  I.getOperandUse(0).swap(I.getOperandUse(1));
+  return true;
+}
+std::string getTypeName(Type *Ty) {
+  if (Ty->isIntegerTy())
+    return "i" + std::to_string(Ty->getScalarSizeInBits());
+  if (Ty->isFloatTy())
+    return "f32";
+  if (Ty->isDoubleTy())
+    return "f64";
+  if (Ty->isHalfTy())
+    return "f16";
+  if (Ty->isBFloatTy())
+    return "bf16";
+  if (Ty->isPointerTy())
+    return "ptr";
+  if (auto *Vec = dyn_cast<FixedVectorType>(Ty)) {
+    auto Sub = getTypeName(Vec->getElementType());
+    if (Sub.empty())
+      return "";
+    return std::to_string(Vec->getNumElements()) + "x" + Sub;
+  }
+  return "";
+}
+bool breakOneUse(Instruction &I) {
+  if (!I.hasOneUse())
+    return false;
+  if (!I.getType()->isSingleValueType())
+    return false;
+  if (I.isTerminator())
+    return false;
+  if (isa<PHINode>(&I))
+    return false;
+
+  auto *Ty = I.getType();
+  auto TyName = getTypeName(Ty);
+  auto *M = I.getModule();
+  auto Callee = M->getOrInsertFunction(
+      "fuzz_use_" + TyName,
+      FunctionType::get(Type::getVoidTy(M->getContext()), {Ty}, false));
+  IRBuilder<> Builder(I.getNextNode());
+  Builder.CreateCall(Callee, &I);
+  return true;
+}
+bool mutateArgAttr(Argument &Arg) {
+  switch (randomUInt(1)) {
+  case 0:
+    if (Arg.getType()->isPointerTy()) {
+      if (Arg.hasNonNullAttr())
+        Arg.removeAttr(Attribute::NonNull);
+      else
+        Arg.addAttr(Attribute::NonNull);
+      return true;
+    }
+    break;
+  case 1:
+    if (Arg.hasAttribute(Attribute::NoUndef))
+      Arg.removeAttr(Attribute::NoUndef);
+    else
+      Arg.addAttr(Attribute::NoUndef);
+    return true;
+  }
+  return false;
+}
+bool replaceArgUse(Instruction &I) {
+  SmallVector<Use *> Uses;
+  for (auto &Op : I.operands())
+    if (isa<Argument>(Op) && !Op->hasOneUse())
+      Uses.push_back(&Op);
+  if (Uses.empty())
+    return false;
+  auto &Op = *Uses[randomUInt(Uses.size() - 1)];
+  SmallVector<Argument *> Replacements;
+  for (auto &Arg : I.getFunction()->args())
+    if (Arg.getType() == Op->getType() && &Arg != Op.get())
+      Replacements.push_back(&Arg);
+  if (Replacements.empty())
+    return false;
+  Op->replaceAllUsesWith(Replacements[randomUInt(Replacements.size() - 1)]);
+  return true;
+}
+bool insertNodes(Instruction &I) {
+  if (I.use_empty() || I.isTerminator())
+    return false;
+  Type *Ty = I.getType();
+  if (randomBool() && (Ty->isIntOrIntVectorTy() || Ty->isPtrOrPtrVectorTy() ||
+                       Ty->isFPOrFPVectorTy())) {
+    for (auto &U : I.uses()) {
+      if (isa<PHINode>(U.getUser()) || isa<FreezeInst>(U.getUser()))
+        continue;
+      if (randomBool()) {
+        IRBuilder<> Builder(cast<Instruction>(U.getUser()));
+        U.set(Builder.CreateFreeze(&I));
+        return true;
+      }
+    }
+  }
+
+  if (Ty->isFPOrFPVectorTy()) {
+    for (auto &U : I.uses()) {
+      if (isa<PHINode>(U.getUser()))
+        continue;
+      if (randomBool()) {
+        IRBuilder<> Builder(cast<Instruction>(U.getUser()));
+        Value *V;
+        switch (randomUInt(1)) {
+        case 0:
+          V = Builder.CreateFNeg(&I);
+        case 1:
+          if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+            auto IID = II->getIntrinsicID();
+            if (IID == Intrinsic::fabs)
+              return false;
+          }
+          V = Builder.CreateUnaryIntrinsic(Intrinsic::fabs, &I);
+        }
+        U.set(V);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Applicability of mutators. Each predicate accepts at least every
+// instruction that the corresponding mutator may change.
+static bool hasMutableConstant(Instruction &I) {
+  if (isa<GetElementPtrInst>(I) || isa<SwitchInst>(I) ||
+      match(&I, m_Intrinsic<Intrinsic::is_fpclass>()) || isa<PHINode>(I))
+    return false;
+  const APInt *C;
+  const APFloat *F;
+  return any_of(I.operands(), [&](Use &Op) {
+    return match(Op.get(), m_APInt(C)) || match(Op.get(), m_APFloat(F));
+  });
+}
+static bool hasFlags(Instruction &I) {
+  return isa<OverflowingBinaryOperator>(I) || isa<PossiblyExactOperator>(I) ||
+         isa<GetElementPtrInst>(I) || isa<TruncInst>(I) ||
+         isa<PossiblyDisjointInst>(I) || isa<PossiblyNonNegInst>(I) ||
+         isa<ICmpInst>(I) || isa<FPMathOperator>(I) || isa<IntrinsicInst>(I);
+}
+static bool hasMutableOpcode(Instruction &I) {
+  if (isa<CmpInst>(I) || isa<MinMaxIntrinsic>(I) || isa<CmpIntrinsic>(I))
+    return true;
+  if (auto *SI = dyn_cast<SelectInst>(&I))
+    return SI->getType()->isIntOrIntVectorTy(1) &&
+           SI->getType() == SI->getCondition()->getType();
+  switch (I.getOpcode()) {
+  case Instruction::LShr:
+  case Instruction::AShr:
+  case Instruction::SExt:
+  case Instruction::ZExt:
+    return true;
+  default:
+    break;
+  }
+  return I.isBitwiseLogicOp() || match(&I, m_Intrinsic<Intrinsic::fshl>()) ||
+         match(&I, m_Intrinsic<Intrinsic::fshr>());
+}
+static bool hasCommutableOperands(Instruction &I) {
+  if (isa<CondBrInst>(I) || isa<SelectInst>(I))
+    return true;
+  if (I.getNumOperands() < 2 || isa<PHINode>(I) || isa<GetElementPtrInst>(I))
+    return false;
+  if (I.getOperand(0)->getType() != I.getOperand(1)->getType())
+    return false;
+  return !isa<CallInst>(I) || I.isCommutative();
+}
+static bool hasReplaceableArgUse(Instruction &I) {
+  return any_of(I.operands(), [](Use &Op) {
+    return isa<Argument>(Op.get()) && !Op->hasOneUse();
+  });
+}
+static bool canInsertNodes(Instruction &I) {
+  return !I.use_empty() && !I.isTerminator();
+}
+static bool isCommutativeInst(Instruction &I) {
+  if (I.getNumOperands() < 2)
+    return false;
+  if (isa<SelectInst>(I))
+    return true;
+  return !isa<Constant>(I.getOperand(1)) &&
+         (isa<CmpInst>(I) || I.isCommutative());
+}
+static bool hasBreakableUse(Instruction &I) {
+  return I.hasOneUse() && I.getType()->isSingleValueType() &&
+         !I.isTerminator() && !isa<PHINode>(I);
+}
+static bool hasCanonicalForm(Instruction &I) {
+  switch (I.getOpcode()) {
+  case Instruction::SExt:
+  case Instruction::SIToFP:
+  case Instruction::Select:
+    return true;
+  case Instruction::Xor:
+  case Instruction::Add:
+    return !I.getType()->isIntOrIntVectorTy(1);
+  case Instruction::ICmp:
+    return cast<ICmpInst>(I).isUnsigned();
+  case Instruction::FCmp:
+    return FCmpInst::isUnordered(cast<FCmpInst>(I).getPredicate());
+  default:
+    return false;
+  }
+}
+
+struct MutatorInfo {
+  bool (*Mutate)(Instruction &I);
+  bool (*Applicable)(Instruction &I);
+};
+// Indexed by MutatorKind. MK_ArgAttr applies to arguments instead.
+static const MutatorInfo Mutators[MK_ArgAttr] = {
+    {mutateConstant, hasMutableConstant},
+    {addFlags, hasFlags},
+    {dropFlags, hasFlags},
+    {mutateOpcode, hasMutableOpcode},
+    {commuteOperands, hasCommutableOperands},
+    {replaceArgUse, hasReplaceableArgUse},
+    {insertNodes, canInsertNodes},
+    {commuteOperandsOfCommutativeInst, isCommutativeInst},
+    {breakOneUse, hasBreakableUse},
+    {canonicalizeOp, hasCanonicalForm},
+};
+
+uint32_t getApplicableMutators(Instruction &I) {
+  uint32_t Mask = 0;
+  for (uint32_t Kind = 0; Kind != MK_ArgAttr; ++Kind)
+    if (Mutators[Kind].Applicable(I))
+      Mask |= 1U << Kind;
+  return Mask;
+}
+
+MutationSiteIndex::MutationSiteIndex(Function &F) {
+  for (auto &Arg : F.args())
+    addSite(&Arg, 1U << MK_ArgAttr);
+  for (auto &BB : F)
+    for (auto &I : BB)
+      addSite(&I, getApplicableMutators(I));
+}
+
+void MutationSiteIndex::addSite(Value *V, uint32_t Mask) {
+  uint32_t Pos = Sites.size();
+  Sites.push_back({V, 0});
+  Positions[V] = Pos;
+  setMask(Pos, Mask);
+}
+
+void MutationSiteIndex::setMask(uint32_t Pos, uint32_t Mask) {
+  // Positions of cleared bits are left in SitesOf and dropped lazily by pick.
+  uint32_t NewBits = Mask & ~Sites[Pos].Mask;
+  Sites[Pos].Mask = Mask;
+  for (uint32_t Kind = 0; Kind != MK_Count; ++Kind)
+    if (NewBits & (1U << Kind))
+      SitesOf[Kind].push_back(Pos);
+}
+
+Value *MutationSiteIndex::pick(MutatorKind Kind) {
+  auto &Candidates = SitesOf[Kind];
+  while (!Candidates.empty()) {
+    uint32_t Idx = randomUInt(Candidates.size() - 1);
+    const Site &S = Sites[Candidates[Idx]];
+    if (S.Mask & (1U << Kind))
+      return S.V;
+    Candidates[Idx] = Candidates.back();
+    Candidates.pop_back();
+  }
+  return nullptr;
+}
+
+void MutationSiteIndex::update(Function &F) {
+  for (auto &I : instructions(F)) {
+    uint32_t Mask = getApplicableMutators(I);
+    auto It = Positions.find(&I);
+    if (It == Positions.end())
+      addSite(&I, Mask);
+    else
+      setMask(It->second, Mask);
+  }
+}
+
+void MutationSiteIndex::replace(Instruction &Old, Value *New) {
+  auto It = Positions.find(&Old);
+  if (It == Positions.end())
+    return;
+  uint32_t Pos = It->second;
+  Positions.erase(It);
+  Sites[Pos].Mask = 0;
+  // IRBuilder may fold the replacement into a constant or an existing value.
+  auto *NewI = dyn_cast<Instruction>(New);
+  if (!NewI || Positions.count(NewI)) {
+    Sites[Pos].V = nullptr;
+    return;
+  }
+  Sites[Pos].V = NewI;
+  Positions[NewI] = Pos;
+  setMask(Pos, getApplicableMutators(*NewI));
+}
+
+// Returns the position of the site V in its function: arguments come first,
+// then instructions in program order.
+static uint32_t getSiteNumber(Value *V) {
+  if (auto *Arg = dyn_cast<Argument>(V))
+    return Arg->getArgNo();
+  auto *I = cast<Instruction>(V);
+  uint32_t Number = I->getFunction()->arg_size();
+  for (auto &Inst : instructions(*I->getFunction())) {
+    if (&Inst == I)
+      break;
+    ++Number;
+  }
+  return Number;
+}
+
+// Returns the site at position Number of F, or nullptr if there is none.
+static Value *getSite(Function &F, uint32_t Number) {
+  if (Number < F.arg_size())
+    return F.getArg(Number);
+  Number -= F.arg_size();
+  for (auto &I : instructions(F))
+    if (Number-- == 0)
+      return &I;
+  return nullptr;
+}
+
+// Applies the mutator Kind to the site V of Index, with a stream seeded with
+// Seed. Returns false if the mutator did not change the site.
+static bool applyMutator(MutationSiteIndex &Index, Value *V, MutatorKind Kind,
+                         uint64_t Seed) {
+  Gen = RandomStream(Seed);
+  if (Kind == MK_ArgAttr)
+    return mutateArgAttr(*cast<Argument>(V));
+  auto &I = *cast<Instruction>(V);
+  // I may be erased by the mutator.
+  Function &F = *I.getFunction();
+  if (!Mutators[Kind].Mutate(I))
+    return false;
+  Index.update(F);
+  return true;
+}
+
+// Applies the mutator Kind to a random site of Index. Returns false if the
+// mutator did not change the site.
+static bool mutateSite(MutationSiteIndex &Index, MutatorKind Kind) {
+  Value *V = Index.pick(Kind);
+  if (!V)
+    return false;
+  // Each edit draws from a stream of its own, so that the journal can replay
+  // it without the choices that led to it.
+  uint64_t Seed = Gen();
+  if (!CurrentJournal)
+    return applyMutator(Index, V, Kind, Seed);
+
+  Function &F = isa<Argument>(V) ? *cast<Argument>(V)->getParent()
+                                 : *cast<Instruction>(V)->getFunction();
+  uint32_t Site = getSiteNumber(V);
+  if (!applyMutator(Index, V, Kind, Seed))
+    return false;
+  CurrentJournal->push_back(
+      {F.getName().str(), Site, MutatorNames[Kind], Seed});
+  return true;
+}
+
+// Recipes
+constexpr uint32_t MaxIterFactor = 100;
+
+bool correctnessCheck(Function &F) {
+  MutationSiteIndex Index(F);
+  CurrentIndex = &Index;
+  auto Reset = make_scope_exit([] { CurrentIndex = nullptr; });
+
+  uint32_t NumArgs = F.arg_size();
+  uint32_t Size = NumArgs;
+  for (auto &BB : F)
+    Size += BB.size();
+
+  uint32_t MutationCount = randomInt(1, 5);
+  uint32_t MutationIter = 0;
+  uint32_t MaxIter = MutationCount * MaxIterFactor;
+
+  // Every step draws from a stream of its own, so the choices made by one
+  // mutator do not shift the ones of the next.
+  RandomStream Parent = Gen;
+  for (uint32_t I = 0; I < MaxIter; ++I) {
+    Gen = Parent.split(I);
+    // Arguments are picked as often as if a random site was chosen among all
+    // arguments and instructions.
+    MutatorKind Kind =
+        randomUInt(Size - 1) < NumArgs
+            ? MK_ArgAttr
+            : static_cast<MutatorKind>(
+                  randomUInt(NumInstMutatorsForCorrectness - 1));
+    if (mutateSite(Index, Kind) && ++MutationIter == MutationCount)
+      return true;
+  }
+  return MutationIter != 0;
+}
+
+bool mutateOnce(Function &F, MutatorKind Kind) {
+  MutationSiteIndex Index(F);
+  CurrentIndex = &Index;
+  auto Reset = make_scope_exit([] { CurrentIndex = nullptr; });
+
+  for (uint32_t I = 0; I < MaxIterFactor; ++I)
+    if (mutateSite(Index, Kind))
+      return true;
+  return false;
+}
+
+bool commutativeCheck(Function &F) {
+  return mutateOnce(F, MK_CommuteCommutative);
+}
+bool multiUseCheck(Function &F) { return mutateOnce(F, MK_BreakOneUse); }
+bool flagPreservingCheck(Function &F) { return mutateOnce(F, MK_AddFlags); }
+// TODO: remove noundef/nonnull on args
+bool flagDroppingCheck(Function &F) { return mutateOnce(F, MK_DropFlags); }
+bool canonicalFormCheck(Function &F) { return mutateOnce(F, MK_Canonicalize); }
+
+MutateFuncTy getRecipe(StringRef Name) {
+  if (Name == "correctness")
+    return correctnessCheck;
+  if (Name == "commutative")
+    return commutativeCheck;
+  if (Name == "multi-use")
+    return multiUseCheck;
+  if (Name == "flag-preserving")
+    return flagPreservingCheck;
+  if (Name == "flag-dropping")
+    return flagDroppingCheck;
+  if (Name == "canonical-form")
+    return canonicalFormCheck;
+  return nullptr;
+}
+
+// A snapshot of a function taken before it is mutated. Unless it is
+// committed, the function is restored to the snapshot when the transaction
+// ends, and the declarations the mutation added to the module are dropped.
+class FunctionTransaction {
+  Function &F;
+  Function *Backup;
+  // Functions are appended to the module, so the ones after this were added
+  // during the transaction.
+  Function *LastBefore;
+
+public:
+  explicit FunctionTransaction(Function &F)
+      : F(F), LastBefore(&F.getParent()->getFunctionList().back()) {
+    ValueToValueMapTy VMap;
+    Backup = CloneFunction(&F, VMap);
+  }
+  ~FunctionTransaction() {
+    if (Backup)
+      rollback();
+  }
+
+  void commit() {
+    Backup->eraseFromParent();
+    Backup = nullptr;
+  }
+
+  void rollback() {
+    // Drop the mutated body and move the original one back in.
+    for (auto &BB : F)
+      BB.dropAllReferences();
+    while (!F.empty())
+      F.begin()->eraseFromParent();
+    F.splice(F.end(), Backup);
+    for (auto [BackupArg, Arg] : zip(Backup->args(), F.args()))
+      BackupArg.replaceAllUsesWith(&Arg);
+    F.setAttributes(Backup->getAttributes());
+    Backup->eraseFromParent();
+    Backup = nullptr;
+    // E.g. the fuzz_use_* helpers of breakOneUse.
+    Module &M = *F.getParent();
+    for (Function &Added : make_early_inc_range(
+             make_range(std::next(LastBefore->getIterator()), M.end())))
+      if (Added.isDeclaration() && Added.use_empty())
+        Added.eraseFromParent();
+  }
+};
+
+constexpr uint32_t MaxAttemptsPerFunction = 4;
+
+// Returns the seed of the stream that mutates F within a module mutated with
+// Seed. It only depends on the name of F, so the mutant of a function is the
+// same whether it is mutated serially, in parallel, or alone.
+static uint64_t getFunctionSeed(uint64_t Seed, const Function &F) {
+  return RandomStream(Seed).split(xxh3_64bits(F.getName()))();
+}
+
+// The outcome of mutating a function.
+struct FunctionResult {
+  bool Mutated = false;
+  // getFunctionHash of the mutant.
+  uint64_t Hash = 0;
+  // Attempts rejected because the mutant was already in the MutantSet.
+  uint32_t Duplicates = 0;
+};
+
+// Runs mutateFunc on F as a transaction. Mutants that are broken, identical
+// to the original or already in Seen are rolled back and the recipe is tried
+// again, so that functions are only dropped from the batch when the recipe
+// keeps failing.
+static FunctionResult mutateFunction(Function &F, MutateFuncTy mutateFunc,
+                                     uint64_t Seed, const MutantSet *Seen) {
+  FunctionResult Res;
+  uint64_t OriginalHash = getFunctionHash(F);
+  size_t JournalSize = CurrentJournal ? CurrentJournal->size() : 0;
+  for (uint32_t Attempt = 0; Attempt != MaxAttemptsPerFunction; ++Attempt) {
+    Gen = RandomStream(Seed).split(Attempt);
+    FunctionTransaction Tx(F);
+    if (mutateFunc(F)) {
+      uint64_t Hash = getFunctionHash(F);
+      if (Hash != OriginalHash && !verifyFunction(F)) {
+        if (!Seen || !Seen->Hashes.contains(Hash)) {
+          Tx.commit();
+          Res.Mutated = true;
+          Res.Hash = Hash;
+          return Res;
+        }
+        ++Res.Duplicates;
+      }
+    }
+    // The edits of a rolled back attempt are dropped with it.
+    if (CurrentJournal)
+      CurrentJournal->resize(JournalSize);
+  }
+  return Res;
+}
+
+static void recordResult(MutantSet *Seen, const FunctionResult &Res) {
+  if (!Seen)
+    return;
+  Seen->Duplicates += Res.Duplicates;
+  if (Res.Mutated) {
+    ++Seen->Mutants;
+    Seen->Hashes.insert(Res.Hash);
+  }
+}
+
+// Drops a function that could not be mutated from the mutant.
+static void eraseFunction(Function &F) {
+  F.replaceAllUsesWith(PoisonValue::get(F.getType()));
+  F.eraseFromParent();
+}
+
+// Moves the body of F into a module of its own, with declarations of only the
+// globals it references, and leaves F a declaration. Splitting a module thus
+// takes time linear in its size, and since the instructions and arguments are
+// moved rather than cloned, their use-lists keep the order the mutators see
+// in the serial path.
+static std::unique_ptr<Module> splitFunction(Function &F) {
+  Module &M = *F.getParent();
+  auto Part = std::make_unique<Module>(F.getName(), F.getContext());
+  Part->setDataLayout(M.getDataLayout());
+  Part->setTargetTriple(M.getTargetTriple());
+
+  Function *NF = Function::Create(F.getFunctionType(), F.getLinkage(),
+                                  F.getAddressSpace(), F.getName(),
+                                  Part.get());
+  NF->copyAttributesFrom(&F);
+  NF->copyMetadata(&F, 0);
+  if (const Comdat *C = F.getComdat()) {
+    Comdat *NC = Part->getOrInsertComdat(C->getName());
+    NC->setSelectionKind(C->getSelectionKind());
+    NF->setComdat(NC);
+  }
+  NF->splice(NF->end(), &F);
+  for (auto [Arg, NewArg] : zip(F.args(), NF->args())) {
+    NewArg.takeName(&Arg);
+    // RAUW moves the uses one at a time to the front of the new use-list.
+    Arg.replaceAllUsesWith(&NewArg);
+    NewArg.reverseUseList();
+  }
+
+  // Collect the globals referenced by the body and the personality, prefix
+  // and prologue data that copyAttributesFrom took over.
+  SmallVector<Constant *> Worklist;
+  for (auto &I : instructions(*NF))
+    for (Value *Op : I.operands())
+      if (auto *C = dyn_cast<Constant>(Op))
+        Worklist.push_back(C);
+  if (NF->hasPersonalityFn())
+    Worklist.push_back(NF->getPersonalityFn());
+  if (NF->hasPrefixData())
+    Worklist.push_back(NF->getPrefixData());
+  if (NF->hasPrologueData())
+    Worklist.push_back(NF->getPrologueData());
+  SmallPtrSet<Constant *, 16> Visited;
+  ValueToValueMapTy VMap;
+  VMap[&F] = NF;
+  while (!Worklist.empty()) {
+    Constant *C = Worklist.pop_back_val();
+    if (!Visited.insert(C).second)
+      continue;
+    auto *GV = dyn_cast<GlobalValue>(C);
+    if (!GV) {
+      for (Value *Op : C->operands())
+        if (auto *OpC = dyn_cast<Constant>(Op))
+          Worklist.push_back(OpC);
+      continue;
+    }
+    if (VMap.count(GV))
+      continue;
+    GlobalValue *Decl;
+    if (auto *FTy = dyn_cast<FunctionType>(GV->getValueType())) {
+      auto *DeclF = Function::Create(FTy, GlobalValue::ExternalLinkage,
+                                     GV->getAddressSpace(), GV->getName(),
+                                     Part.get());
+      if (auto *SrcF = dyn_cast<Function>(GV))
+        DeclF->copyAttributesFrom(SrcF);
+      // Personality functions are not valid on declarations.
+      DeclF->setPersonalityFn(nullptr);
+      DeclF->setPrefixData(nullptr);
+      DeclF->setPrologueData(nullptr);
+      DeclF->setComdat(nullptr);
+      Decl = DeclF;
+    } else {
+      auto *SrcGV = dyn_cast<GlobalVariable>(GV);
+      Decl = new GlobalVariable(
+          *Part, GV->getValueType(), SrcGV && SrcGV->isConstant(),
+          GlobalValue::ExternalLinkage, nullptr, GV->getName(), nullptr,
+          GV->getThreadLocalMode(), GV->getAddressSpace());
+      if (SrcGV)
+        cast<GlobalVariable>(Decl)->setAlignment(SrcGV->getAlign());
+    }
+    VMap[GV] = Decl;
+  }
+
+  // Only the uses of constants that refer to globals are rewritten, so that
+  // the use-lists of the other values stay as they are.
+  for (auto &I : instructions(*NF))
+    for (Use &U : I.operands())
+      if (auto *C = dyn_cast<Constant>(U.get()))
+        if (Value *NewC = MapValue(C, VMap, RF_IgnoreMissingLocals);
+            NewC != C)
+          U.set(NewC);
+  if (NF->hasPersonalityFn())
+    NF->setPersonalityFn(MapValue(NF->getPersonalityFn(), VMap));
+  if (NF->hasPrefixData())
+    NF->setPrefixData(MapValue(NF->getPrefixData(), VMap));
+  if (NF->hasPrologueData())
+    NF->setPrologueData(MapValue(NF->getPrologueData(), VMap));
+  return Part;
+}
+
+// Mutates the functions of M concurrently. Each function is moved into a
+// module of its own in a separate LLVMContext through a bitcode round-trip
+// that preserves use-list order, mutated on the thread pool, and linked back
+// in the original order. The MutantSet is only read by the jobs and updated in
+// function order once they are done, so the mutant does not depend on
+// scheduling.
+static void mutateModuleParallel(Module &M, MutateFuncTy mutateFunc,
+                                 uint64_t Seed, const MutationOptions &Opts) {
+  // Symbols with local linkage cannot be referenced across modules.
+  SmallVector<std::pair<std::string, GlobalValue::LinkageTypes>> Locals;
+  for (auto &GV : M.global_values())
+    if (GV.hasLocalLinkage()) {
+      Locals.emplace_back(GV.getName().str(), GV.getLinkage());
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+    }
+
+  struct Job {
+    Function *F;
+    std::string Name;
+    uint64_t Seed;
+    SmallVector<char, 0> Input;
+    SmallVector<char, 0> Output;
+    MutationJournal Edits;
+    FunctionResult Res;
+  };
+  std::vector<Job> Jobs;
+  for (auto &F : M)
+    if (!F.isDeclaration())
+      Jobs.push_back({&F, F.getName().str(), getFunctionSeed(Seed, F)});
+
+  for (auto &J : Jobs) {
+    auto Part = splitFunction(*J.F);
+    raw_svector_ostream OS(J.Input);
+    WriteBitcodeToFile(*Part, OS, /*ShouldPreserveUseListOrder=*/true);
+  }
+
+  {
+    DefaultThreadPool Pool(hardware_concurrency(Opts.Threads));
+    for (auto &J : Jobs)
+      Pool.async([&J, mutateFunc, &Opts] {
+        CurrentJournal = Opts.Journal ? &J.Edits : nullptr;
+        auto Reset = make_scope_exit([] { CurrentJournal = nullptr; });
+        LLVMContext Ctx;
+        auto Part = cantFail(parseBitcodeFile(
+            MemoryBufferRef(StringRef(J.Input.data(), J.Input.size()), J.Name),
+            Ctx));
+        J.Res = mutateFunction(*Part->getFunction(J.Name), mutateFunc, J.Seed,
+                               Opts.Seen);
+        if (J.Res.Mutated) {
+          raw_svector_ostream OS(J.Output);
+          WriteBitcodeToFile(*Part, OS, /*ShouldPreserveUseListOrder=*/true);
+        }
+      });
+    Pool.wait();
+  }
+
+  // Linking a definition replaces the declaration left behind by
+  // splitFunction and appends the new function, so the mutants end up in the
+  // original order.
+  for (auto &J : Jobs) {
+    if (!J.Res.Mutated)
+      continue;
+    auto Part = cantFail(parseBitcodeFile(
+        MemoryBufferRef(StringRef(J.Output.data(), J.Output.size()), J.Name),
+        M.getContext()));
+    if (Linker::linkModules(M, std::move(Part)))
+      report_fatal_error("Failed to link mutant of " + Twine(J.Name));
+  }
+  for (auto &J : Jobs) {
+    recordResult(Opts.Seen, J.Res);
+    if (J.Res.Mutated) {
+      if (Opts.Journal)
+        Opts.Journal->insert(Opts.Journal->end(), J.Edits.begin(),
+                             J.Edits.end());
+      continue;
+    }
+    eraseFunction(*M.getFunction(J.Name));
+  }
+
+  for (auto &[Name, Linkage] : Locals)
+    if (auto *GV = M.getNamedValue(Name); GV && !GV->isDeclaration())
+      GV->setLinkage(Linkage);
+}
+
+void mutateModule(Module &M, MutateFuncTy mutateFunc, uint64_t Seed,
+                  const MutationOptions &Opts) {
+  if (Opts.Threads != 1) {
+    mutateModuleParallel(M, mutateFunc, Seed, Opts);
+    return;
+  }
+
+  CurrentJournal = Opts.Journal;
+  auto Reset = make_scope_exit([] { CurrentJournal = nullptr; });
+
+  SmallVector<Function *> Funcs;
+  for (auto &F : M)
+    if (!F.isDeclaration())
+      Funcs.push_back(&F);
+
+  SmallVector<Function *> ErasedFuncs;
+  for (auto &Func : Funcs) {
+    FunctionResult Res = mutateFunction(
+        *Func, mutateFunc, getFunctionSeed(Seed, *Func), Opts.Seen);
+    recordResult(Opts.Seen, Res);
+    if (!Res.Mutated)
+      ErasedFuncs.push_back(Func);
+  }
+  for (auto *Func : ErasedFuncs)
+    eraseFunction(*Func);
+}
+
+Error replayJournal(Module &M, const MutationJournal &Journal,
+                    size_t NumEdits) {
+  auto Fail = [](const Twine &Msg) {
+    return createStringError(inconvertibleErrorCode(), Msg);
+  };
+
+  StringSet<> Mutated;
+  for (auto &Edit : Journal)
+    Mutated.insert(Edit.Function);
+
+  for (size_t Idx = 0, E = std::min(NumEdits, Journal.size()); Idx != E;
+       ++Idx) {
+    const MutationEdit &Edit = Journal[Idx];
+    Function *F = M.getFunction(Edit.Function);
+    if (!F || F->isDeclaration())
+      return Fail("edit " + Twine(Idx) + ": no function " + Edit.Function);
+    auto *Name = find(MutatorNames, Edit.Mutator);
+    if (Name == std::end(MutatorNames))
+      return Fail("edit " + Twine(Idx) + ": unknown mutator " + Edit.Mutator);
+    auto Kind = static_cast<MutatorKind>(Name - std::begin(MutatorNames));
+    Value *V = getSite(*F, Edit.Site);
+    if (!V || isa<Argument>(V) != (Kind == MK_ArgAttr))
+      return Fail("edit " + Twine(Idx) + ": invalid site " +
+                  Twine(Edit.Site));
+
+    MutationSiteIndex Index(*F);
+    CurrentIndex = &Index;
+    auto Reset = make_scope_exit([] { CurrentIndex = nullptr; });
+    if (!applyMutator(Index, V, Kind, Edit.Seed))
+      return Fail("edit " + Twine(Idx) + " does not apply");
+  }
+
+  SmallVector<Function *> ErasedFuncs;
+  for (auto &F : M)
+    if (!F.isDeclaration() && !Mutated.contains(F.getName()))
+      ErasedFuncs.push_back(&F);
+  for (auto *Func : ErasedFuncs)
+    eraseFunction(*Func);
+  return Error::success();
+}
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Function;
+class Module;
+} // namespace llvm
+
+using MutateFuncTy = bool (*)(llvm::Function &F);
+
+// An edit applied by mutateModule: Mutator changed site Site of Function
+// (arguments first, then instructions in program order), drawing its random
+// choices from a stream seeded with Seed.
+struct MutationEdit {
+  std::string Function;
+  uint32_t Site;
+  std::string Mutator;
+  uint64_t Seed;
+};
+using MutationJournal = std::vector<MutationEdit>;
+
+// The getFunctionHash of the function mutants produced so far, e.g. within a
+// campaign. Mutants that are already in the set are rejected and the recipe is
+// tried again, so opt and alive2 never see the same function twice.
+struct MutantSet {
+  llvm::DenseSet<uint64_t> Hashes;
+  // Functions mutated, and attempts rejected as duplicates.
+  uint64_t Mutants = 0;
+  uint64_t Duplicates = 0;
+};
+
+struct MutationOptions {
+  // With more than one thread, or 0 for all cores, functions are mutated
+  // concurrently in separate contexts.
+  uint32_t Threads = 1;
+  // If set, the applied edits are appended to it.
+  MutationJournal *Journal = nullptr;
+  // If set, duplicate mutants are rejected and new ones are added to it.
+  MutantSet *Seen = nullptr;
+};
+
+// Returns the mutation recipe called Name, or nullptr if there is none.
+MutateFuncTy getRecipe(llvm::StringRef Name);
+// Applies mutateFunc to every function defined in M. Functions that cannot
+// be mutated are erased. The mutant only depends on M, mutateFunc, Seed and
+// the MutantSet, if any.
+void mutateModule(llvm::Module &M, MutateFuncTy mutateFunc, uint64_t Seed,
+                  const MutationOptions &Opts = {});
+// Applies the first NumEdits edits of Journal to M, the module the journal was
+// recorded on. As in mutateModule, functions without edits in the journal are
+// erased.
+llvm::Error replayJournal(llvm::Module &M, const MutationJournal &Journal,
+                          size_t NumEdits = SIZE_MAX);
+// Returns a fresh seed for callers that were not given one.
+uint64_t getRandomSeed();
+// Returns min(Count, Size) distinct indices below Size in increasing order,
+// picked at random with Seed, e.g. the functions of a large seed that a mutant
+// is made of.
+std::vector<uint32_t> sampleIndices(uint32_t Size, uint32_t Count,
+                                    uint64_t Seed);
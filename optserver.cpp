@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "io.h"
+#include "process.h"
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+    Passes("passes", cl::desc("Pass pipeline to run, as in opt -passes=..."),
+           cl::Required);
+static cl::opt<uint32_t>
+    Timeout("timeout",
+            cl::desc("Seconds after which a request is killed (0 = never)"),
+            cl::init(60));
+static cl::opt<bool> EmitBitcode("emit-bc",
+                                 cl::desc("Write bitcode instead of textual IR"),
+                                 cl::init(false));
+
+// A fork-server for the opt stage. The pass pipeline is built once, then a
+// child is forked for each request so that the dynamic loading and static
+// initialization of the LLVM libraries are paid only once.
+//
+// Each request is a line '<input> <output>'. It is answered with 'ok',
+// 'crash' (the child died or failed), 'timeout' or 'error <message>'.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "optserver\n");
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB;
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (Error E = PB.parsePassPipeline(MPM, Passes)) {
+    errs() << toString(std::move(E)) << '\n';
+    return EXIT_FAILURE;
+  }
+
+  for (std::string Line; std::getline(std::cin, Line);) {
+    auto [Input, Output] = StringRef(Line).trim().split(' ');
+    Output = Output.trim();
+    if (Input.empty())
+      continue;
+    if (Output.empty()) {
+      outs() << "error missing output\n";
+      outs().flush();
+      continue;
+    }
+
+    ChildResult Res = runInChild(
+        [&] {
+          LLVMContext Ctx;
+          SMDiagnostic Err;
+          auto M = parseIRFile(Input, Err, Ctx);
+          if (!M) {
+            Err.print(argv[0], errs());
+            return EXIT_FAILURE;
+          }
+          // Like opt, invalid input is an error and invalid output a crash.
+          if (verifyModule(*M, &errs()))
+            return EXIT_FAILURE;
+          MPM.run(*M, MAM);
+          if (verifyModule(*M, &errs()))
+            return EXIT_FAILURE;
+
+          return writeModule(*M, Output, EmitBitcode) ? EXIT_SUCCESS
+                                                      : EXIT_FAILURE;
+        },
+        Timeout);
+
+    if (Res.succeeded())
+      outs() << "ok\n";
+    else if (Res.Kind == ChildResult::TimedOut)
+      outs() << "timeout\n";
+    else
+      outs() << "crash\n";
+    outs().flush();
+  }
+
+  return EXIT_SUCCESS;
+}
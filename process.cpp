@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "process.h"
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+struct Child {
+  size_t Idx;
+  pid_t Pid;
+  // The read end of a pipe whose write end only the child holds. It is
+  // closed when the child terminates, which lets the parent poll for it.
+  int Fd;
+  std::chrono::steady_clock::time_point Start;
+  std::chrono::steady_clock::time_point Deadline;
+};
+} // namespace
+
+static Child spawn(size_t Idx, function_ref<int(size_t)> Body,
+                   uint32_t TimeoutSec) {
+  int Pipe[2];
+  if (pipe(Pipe) != 0)
+    report_fatal_error("pipe() failed");
+
+  outs().flush();
+  errs().flush();
+  pid_t Pid = fork();
+  if (Pid < 0)
+    report_fatal_error("fork() failed");
+  if (Pid == 0) {
+    close(Pipe[0]);
+    int Code = Body(Idx);
+    outs().flush();
+    errs().flush();
+    _exit(Code);
+  }
+  close(Pipe[1]);
+
+  auto Start = std::chrono::steady_clock::now();
+  auto Deadline = TimeoutSec ? Start + std::chrono::seconds(TimeoutSec)
+                             : std::chrono::steady_clock::time_point::max();
+  return {Idx, Pid, Pipe[0], Start, Deadline};
+}
+
+// Waits for a child that has exited or been killed.
+static ChildResult reap(const Child &C, bool TimedOut) {
+  close(C.Fd);
+  int Status;
+  while (waitpid(C.Pid, &Status, 0) < 0 && errno == EINTR)
+    ;
+  uint64_t ElapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() - C.Start)
+                           .count();
+  if (TimedOut)
+    return {ChildResult::TimedOut, SIGKILL, ElapsedMs};
+  if (WIFSIGNALED(Status))
+    return {ChildResult::Signaled, WTERMSIG(Status), ElapsedMs};
+  return {ChildResult::Exited, WEXITSTATUS(Status), ElapsedMs};
+}
+
+void runTasks(function_ref<std::optional<ChildTask>()> Next,
+              function_ref<int(size_t)> Body, uint32_t Jobs,
+              function_ref<bool(size_t, ChildResult)> OnResult) {
+  using namespace std::chrono;
+  std::vector<Child> Running;
+  bool Cancelled = false;
+  while (!Cancelled) {
+    while (Running.size() < std::max(Jobs, 1U)) {
+      auto Task = Next();
+      if (!Task)
+        break;
+      Running.push_back(spawn(Task->Idx, Body, Task->TimeoutSec));
+    }
+    if (Running.empty())
+      break;
+
+    auto Now = steady_clock::now();
+    int Wait = -1;
+    std::vector<pollfd> PFDs;
+    for (auto &C : Running) {
+      PFDs.push_back({C.Fd, POLLIN, 0});
+      if (C.Deadline != steady_clock::time_point::max()) {
+        auto Left = std::max<int64_t>(
+            0, duration_cast<milliseconds>(C.Deadline - Now).count());
+        Wait = Wait < 0 ? Left : std::min<int64_t>(Wait, Left);
+      }
+    }
+    int Ret;
+    do
+      Ret = poll(PFDs.data(), PFDs.size(), Wait);
+    while (Ret < 0 && errno == EINTR);
+
+    Now = steady_clock::now();
+    std::vector<Child> StillRunning;
+    for (auto [C, PFD] : zip(Running, PFDs)) {
+      bool Done = PFD.revents != 0;
+      bool TimedOut = !Done && Now >= C.Deadline;
+      if (!Done && !TimedOut) {
+        StillRunning.push_back(C);
+        continue;
+      }
+      if (TimedOut)
+        kill(C.Pid, SIGKILL);
+      ChildResult Res = reap(C, TimedOut);
+      if (!Cancelled && !OnResult(C.Idx, Res))
+        Cancelled = true;
+    }
+    Running = std::move(StillRunning);
+  }
+
+  for (auto &C : Running) {
+    kill(C.Pid, SIGKILL);
+    reap(C, /*TimedOut=*/true);
+  }
+}
+
+void runInChildren(size_t Count, function_ref<int(size_t)> Body,
+                   uint32_t Jobs, uint32_t TimeoutSec,
+                   function_ref<bool(size_t, ChildResult)> OnResult) {
+  size_t NextIdx = 0;
+  runTasks(
+      [&]() -> std::optional<ChildTask> {
+        if (NextIdx == Count)
+          return std::nullopt;
+        return ChildTask{NextIdx++, TimeoutSec};
+      },
+      Body, Jobs, OnResult);
+}
+
+ChildResult runInChild(function_ref<int()> Body, uint32_t TimeoutSec) {
+  ChildResult Result{ChildResult::Exited, 0};
+  runInChildren(
+      1, [&](size_t) { return Body(); }, /*Jobs=*/1, TimeoutSec,
+      [&](size_t, ChildResult Res) {
+        Result = Res;
+        return true;
+      });
+  return Result;
+}
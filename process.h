@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+struct ChildResult {
+  enum { Exited, Signaled, TimedOut } Kind;
+  // The exit code if the child exited, or the signal that terminated it.
+  int Code;
+  // Wall-clock time the child ran for.
+  uint64_t ElapsedMs = 0;
+
+  bool succeeded() const { return Kind == Exited && Code == 0; }
+};
+
+// Runs Body in a forked child and returns how the child terminated. The
+// return value of Body is the exit code of the child. The child is killed if
+// it is still running after TimeoutSec seconds (0 means no timeout).
+ChildResult runInChild(llvm::function_ref<int()> Body, uint32_t TimeoutSec);
+// Runs Body(0) ... Body(Count - 1) in forked children, at most Jobs at a
+// time, each with its own timeout. OnResult is called in the parent as each
+// child terminates; if it returns false, the running children are killed and
+// the remaining bodies are skipped.
+void runInChildren(size_t Count, llvm::function_ref<int(size_t)> Body,
+                   uint32_t Jobs, uint32_t TimeoutSec,
+                   llvm::function_ref<bool(size_t, ChildResult)> OnResult);
+
+struct ChildTask {
+  size_t Idx;
+  uint32_t TimeoutSec;
+};
+// Like runInChildren, but the bodies to run are pulled from Next whenever a
+// slot is free, so that OnResult can queue more work, e.g. a retry. Next
+// returns std::nullopt if there is nothing to start right now; the call
+// returns once nothing is running and Next has nothing left.
+void runTasks(llvm::function_ref<std::optional<ChildTask>()> Next,
+              llvm::function_ref<int(size_t)> Body, uint32_t Jobs,
+              llvm::function_ref<bool(size_t, ChildResult)> OnResult);
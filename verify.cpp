@@ -0,0 +1,575 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "fingerprint.h"
+#include "interp.h"
+#include "process.h"
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/LineIterator.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include <llvm/TargetParser/Triple.h>
+
+#include "llvm_util/compare.h"
+#include "llvm_util/llvm2alive.h"
+#include "smt/smt.h"
+#include "util/config.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+
+using namespace llvm;
+
+static cl::opt<std::string> SrcFile(cl::Positional, cl::desc("<src>"),
+                                    cl::value_desc("source module"));
+static cl::opt<std::string> TgtFile(cl::Positional, cl::desc("<tgt>"),
+                                    cl::value_desc("target module"));
+static cl::opt<uint32_t>
+    SMTTimeout("smt-to",
+               cl::desc("Timeout of each SMT query (ms) in the first attempt "
+                        "to verify a function"),
+               cl::init(100));
+static cl::opt<uint32_t> SMTTimeoutMax(
+    "smt-to-max",
+    cl::desc("Largest SMT timeout (ms). Functions that time out are queued "
+             "again with ten times the SMT timeout until this is reached, "
+             "after the first attempts of the others (0 = no retries)"),
+    cl::init(0));
+static cl::opt<bool> DisableUndefInput("disable-undef-input",
+                                       cl::desc("Assume inputs are not undef"),
+                                       cl::init(false));
+static cl::opt<bool>
+    Serve("serve",
+          cl::desc("Answer requests '<src> <tgt>' read line by line from "
+                   "stdin. Each request is answered with one line of JSON or "
+                   "'error <message>' on stdout"),
+          cl::init(false));
+static cl::opt<uint32_t>
+    Timeout("timeout",
+            cl::desc("Wall-clock seconds after which the verification of a "
+                     "function is killed (0 = never)"),
+            cl::init(20));
+static cl::opt<uint32_t> MaxTimeout(
+    "max-timeout",
+    cl::desc("Wall-clock seconds after which a retry is killed. The timeout "
+             "grows with the SMT timeout, from --timeout up to this"),
+    cl::init(120));
+static cl::opt<std::string> BudgetHistory(
+    "budget-history",
+    cl::desc("File that the SMT timeout each function needed is stored in. "
+             "Functions that needed a larger one before start with it"),
+    cl::value_desc("path"));
+static cl::opt<uint32_t> Jobs("jobs",
+                              cl::desc("Number of functions verified at once"),
+                              cl::init(1));
+static cl::opt<bool> StopOnIncorrect(
+    "stop-on-incorrect",
+    cl::desc("Skip the remaining functions once one is found incorrect"),
+    cl::init(false));
+static cl::opt<std::string>
+    CacheFile("cache",
+              cl::desc("File that verdicts are stored in and reused from "
+                       "across runs"),
+              cl::value_desc("path"));
+static cl::opt<uint32_t> ScreenInputs(
+    "screen-inputs",
+    cl::desc("Number of concrete inputs src and tgt are run on before Alive2. "
+             "Functions with a mismatch are incorrect without an SMT query "
+             "(0 = disabled)"),
+    cl::init(4096));
+static cl::opt<std::string>
+    CacheTag("cache-tag",
+             cl::desc("Revisions of LLVM and Alive2. Cached verdicts are only "
+                      "reused with the same tag"),
+             cl::init(""));
+
+static uint32_t getMaxBudget() {
+  return std::max<uint32_t>(SMTTimeout, SMTTimeoutMax);
+}
+
+// The wall-clock timeout of an attempt with the given SMT timeout.
+static uint32_t getWallTimeout(uint32_t Budget) {
+  if (!Timeout || !SMTTimeout)
+    return Timeout;
+  uint64_t Scaled = static_cast<uint64_t>(Timeout) * Budget / SMTTimeout;
+  return std::clamp<uint64_t>(Scaled, Timeout,
+                              std::max<uint32_t>(Timeout, MaxTimeout));
+}
+
+namespace {
+// Ordered from the most to the least interesting after Correct.
+enum class Verdict {
+  Correct,
+  Incorrect,
+  Crash,
+  Timeout,
+  Unsupported,
+  Skipped
+};
+
+StringRef getVerdictName(Verdict V) {
+  switch (V) {
+  case Verdict::Correct:
+    return "correct";
+  case Verdict::Incorrect:
+    return "incorrect";
+  case Verdict::Crash:
+    return "crash";
+  case Verdict::Timeout:
+    return "timeout";
+  case Verdict::Unsupported:
+    return "unsupported";
+  case Verdict::Skipped:
+    return "skipped";
+  }
+  llvm_unreachable("Unknown verdict");
+}
+
+// The exit code of a verification child whose screen found a mismatch.
+constexpr int ScreenedIncorrect = 100;
+// The screen runs in a grandchild with this timeout, so that an interpreter
+// crash or hang only costs the screen and Alive2 still gets the function.
+constexpr uint32_t ScreenTimeoutSec = 5;
+
+std::optional<Verdict> parseVerdict(StringRef Name) {
+  for (Verdict V : {Verdict::Correct, Verdict::Incorrect, Verdict::Timeout,
+                    Verdict::Unsupported})
+    if (getVerdictName(V) == Name)
+      return V;
+  return std::nullopt;
+}
+
+// Verdicts of (src, tgt) function pairs, keyed by their getFunctionHash (which
+// covers the globals they reference), the module layout, the options and the
+// cache tag. Mutants that optimize to a known pair, e.g. because the pass
+// undid the mutation, skip SMT entirely. An SMT timeout only holds for the SMT
+// timeout it was reached with, so it is stored under getTimeoutKey and a
+// larger --smt-to-max tries the pair again.
+// The file is a log of '<key> <verdict>' lines. Several servers may append to
+// it at once; each line goes out in a single write.
+class VerdictCache {
+  // Part of every key. Bump it whenever getFunctionHash or the key changes, so
+  // that verdicts stored under the old hashes are no longer found.
+  static constexpr uint64_t Version = 3;
+
+  DenseMap<uint64_t, Verdict> Entries;
+  std::unique_ptr<raw_fd_ostream> Log;
+
+public:
+  void open(StringRef Path) {
+    if (auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/true)) {
+      for (line_iterator It(**Buffer); !It.is_at_eof(); ++It) {
+        auto [KeyStr, Name] = It->split(' ');
+        uint64_t Key;
+        if (KeyStr.getAsInteger(16, Key))
+          continue;
+        if (auto V = parseVerdict(Name))
+          Entries[Key] = *V;
+      }
+    }
+    std::error_code EC;
+    Log = std::make_unique<raw_fd_ostream>(Path, EC, sys::fs::OF_Append);
+    if (EC) {
+      errs() << "Cannot open the verdict cache: " << EC.message() << '\n';
+      Log.reset();
+    }
+  }
+
+  static uint64_t getKey(const Module &M, const Function &Src,
+                         const Function &Tgt) {
+    uint64_t Data[] = {Version, getFunctionHash(Src), getFunctionHash(Tgt),
+                       xxh3_64bits(M.getDataLayoutStr()),
+                       xxh3_64bits(CacheTag), DisableUndefInput};
+    return xxh3_64bits(ArrayRef(reinterpret_cast<const uint8_t *>(Data),
+                                sizeof(Data)));
+  }
+
+  static uint64_t getTimeoutKey(uint64_t Key, uint32_t Budget) {
+    uint64_t Data[] = {Key, Budget};
+    return xxh3_64bits(ArrayRef(reinterpret_cast<const uint8_t *>(Data),
+                                sizeof(Data)));
+  }
+
+  std::optional<Verdict> lookup(uint64_t Key) const {
+    auto It = Entries.find(Key);
+    if (It == Entries.end())
+      return std::nullopt;
+    return It->second;
+  }
+
+  void insert(uint64_t Key, Verdict V) {
+    if (!Entries.try_emplace(Key, V).second || !Log)
+      return;
+    SmallString<32> Line;
+    raw_svector_ostream(Line) << format_hex_no_prefix(Key, 16) << ' '
+                              << getVerdictName(V) << '\n';
+    *Log << Line;
+    Log->flush();
+  }
+};
+
+// The SMT timeout and the time each function needed for a verdict, keyed by
+// its name: mutants keep the names of the seed functions, and merge makes
+// those unique. Like the verdict cache, the file is an append-only log of
+// '<key> <smt-to> <ms>' lines, and the last line of a key wins.
+class BudgetLog {
+  DenseMap<uint64_t, uint32_t> Budgets;
+  std::unique_ptr<raw_fd_ostream> Log;
+
+public:
+  void open(StringRef Path) {
+    if (auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/true)) {
+      for (line_iterator It(**Buffer); !It.is_at_eof(); ++It) {
+        SmallVector<StringRef, 3> Fields;
+        It->split(Fields, ' ');
+        uint64_t Key;
+        uint32_t Budget;
+        if (Fields.size() == 3 && !Fields[0].getAsInteger(16, Key) &&
+            !Fields[1].getAsInteger(10, Budget))
+          Budgets[Key] = Budget;
+      }
+    }
+    std::error_code EC;
+    Log = std::make_unique<raw_fd_ostream>(Path, EC, sys::fs::OF_Append);
+    if (EC) {
+      errs() << "Cannot open the budget history: " << EC.message() << '\n';
+      Log.reset();
+    }
+  }
+
+  static uint64_t getKey(const Function &F) { return xxh3_64bits(F.getName()); }
+
+  // The SMT timeout to start verifying F with.
+  uint32_t predict(const Function &F) const {
+    uint32_t Budget = Budgets.lookup(getKey(F));
+    return std::clamp<uint32_t>(Budget, SMTTimeout, getMaxBudget());
+  }
+
+  void record(const Function &F, uint32_t Budget, uint64_t ElapsedMs) {
+    uint64_t Key = getKey(F);
+    Budgets[Key] = Budget;
+    if (!Log)
+      return;
+    SmallString<48> Line;
+    raw_svector_ostream(Line) << format_hex_no_prefix(Key, 16) << ' ' << Budget
+                              << ' ' << ElapsedMs << '\n';
+    *Log << Line;
+    Log->flush();
+  }
+};
+
+// Prints the globals F references, directly or through constants and the
+// initializers of other globals: variables with their definitions, functions
+// with their types and attributes.
+static void printReferencedGlobals(const Function &F, raw_ostream &OS) {
+  SmallPtrSet<const Constant *, 16> Visited;
+  SmallVector<const Constant *> Worklist;
+  for (auto &I : instructions(F))
+    for (auto &Op : I.operands())
+      if (auto *C = dyn_cast<Constant>(Op))
+        Worklist.push_back(C);
+  while (!Worklist.empty()) {
+    const Constant *C = Worklist.pop_back_val();
+    if (!Visited.insert(C).second)
+      continue;
+    if (auto *Var = dyn_cast<GlobalVariable>(C)) {
+      OS << *Var << '\n';
+      if (Var->hasInitializer())
+        Worklist.push_back(Var->getInitializer());
+    } else if (auto *Callee = dyn_cast<Function>(C)) {
+      OS << Callee->getName() << ' ' << Callee->getLinkage() << ' '
+         << *Callee->getFunctionType() << ' ';
+      Callee->getAttributes().print(OS);
+    } else if (auto *GV = dyn_cast<GlobalValue>(C)) {
+      OS << *GV << '\n';
+    } else {
+      for (auto &Op : C->operands())
+        if (auto *OpC = dyn_cast<Constant>(Op))
+          Worklist.push_back(OpC);
+    }
+  }
+}
+
+// Whether the pass left Src unchanged. Equal hashes only pick the candidates,
+// which are confirmed by comparing their printed IR and that of the globals
+// they reference, so that a hash collision can never make a function correct.
+static bool isUnchanged(const Function &Src, const Function &Tgt) {
+  if (getFunctionHash(Src) != getFunctionHash(Tgt))
+    return false;
+  auto Print = [](const Function &F) {
+    std::string Text;
+    raw_string_ostream OS(Text);
+    OS << F;
+    printReferencedGlobals(F, OS);
+    return Text;
+  };
+  return Print(Src) == Print(Tgt);
+}
+
+// Verifies (src, tgt) function pairs with Alive2. The SMT context lives as
+// long as the verifier, so Z3 is only started once for all requests.
+class PairVerifier {
+  smt::smt_initializer SMTInit;
+  VerdictCache Cache;
+  BudgetLog Budgets;
+
+  Verdict verifyFunction(Function &Src, Function &Tgt,
+                         TargetLibraryInfoWrapperPass &TLI) {
+    std::ostringstream Report;
+    llvm_util::Verifier V(TLI, SMTInit, Report);
+    V.quiet = true;
+    V.compareFunctions(Src, Tgt);
+    if (V.num_unsound)
+      return Verdict::Incorrect;
+    // Verifier only exposes counters, and the Errors it collects are
+    // (message, unsound) pairs without a kind, so an SMT timeout can only be
+    // told apart from other failures by the message Alive2 prints for it.
+    if (V.num_failed)
+      return Report.str().find("Timeout") != std::string::npos
+                 ? Verdict::Timeout
+                 : Verdict::Unsupported;
+    if (V.num_errors)
+      return Verdict::Unsupported;
+    return Verdict::Correct;
+  }
+
+public:
+  PairVerifier() {
+    if (!CacheFile.empty())
+      Cache.open(CacheFile);
+    if (!BudgetHistory.empty())
+      Budgets.open(BudgetHistory);
+  }
+
+  // Verifies every function defined in both modules. Functions the pass left
+  // unchanged are correct without asking Alive2. The others are verified in
+  // children of their own, so that a pathological function only costs its own
+  // timeout and cannot take the verdicts of the others down with it. Before
+  // its first SMT query, a child runs the function on concrete inputs, and a
+  // mismatch makes it incorrect; such verdicts are not cached since no SMT
+  // query confirmed them. A function that times out is queued again with a
+  // larger SMT timeout, behind the first attempts of the others, so that
+  // retries only take slots that would otherwise be idle. The overall verdict
+  // is the most interesting one.
+  Expected<json::Object> verify(StringRef SrcPath, StringRef TgtPath) {
+    LLVMContext Ctx;
+    SMDiagnostic Err;
+    auto Src = parseIRFile(SrcPath, Err, Ctx);
+    if (!Src)
+      return createStringError(inconvertibleErrorCode(),
+                               "cannot parse " + SrcPath);
+    auto Tgt = parseIRFile(TgtPath, Err, Ctx);
+    if (!Tgt)
+      return createStringError(inconvertibleErrorCode(),
+                               "cannot parse " + TgtPath);
+
+    TargetLibraryInfoWrapperPass TLI(Triple(Src->getTargetTriple()));
+    std::ostringstream Log;
+    llvm_util::initializer Init(Log, Src->getDataLayout());
+
+    struct Pair {
+      Function *Src;
+      Function *Tgt;
+      uint64_t Key;
+      bool Identical;
+      Verdict V = Verdict::Skipped;
+      // Whether the next attempt screens the function first.
+      bool Screen = true;
+      bool Screened = false;
+      uint32_t Budget = 0;
+      uint64_t ElapsedMs = 0;
+    };
+    std::vector<Pair> Pairs;
+    std::vector<size_t> Pending;
+    for (auto &SrcF : *Src) {
+      if (SrcF.isDeclaration())
+        continue;
+      Function *TgtF = Tgt->getFunction(SrcF.getName());
+      if (!TgtF || TgtF->isDeclaration())
+        continue;
+      Pair P{&SrcF, TgtF, VerdictCache::getKey(*Src, SrcF, *TgtF),
+             isUnchanged(SrcF, *TgtF)};
+      if (P.Identical) {
+        P.V = Verdict::Correct;
+      } else if (auto Cached = Cache.lookup(P.Key)) {
+        P.V = *Cached;
+      } else if (Cache.lookup(
+                     VerdictCache::getTimeoutKey(P.Key, getMaxBudget()))) {
+        P.V = Verdict::Timeout;
+      } else {
+        P.Budget = Budgets.predict(SrcF);
+        Pending.push_back(Pairs.size());
+      }
+      Pairs.push_back(P);
+    }
+
+    if (StopOnIncorrect &&
+        any_of(Pairs, [](const Pair &P) { return P.V == Verdict::Incorrect; }))
+      Pending.clear();
+    size_t NextPending = 0;
+    std::deque<size_t> Retries;
+    runTasks(
+        [&]() -> std::optional<ChildTask> {
+          size_t I;
+          if (NextPending != Pending.size()) {
+            I = Pending[NextPending++];
+          } else if (!Retries.empty()) {
+            I = Retries.front();
+            Retries.pop_front();
+          } else {
+            return std::nullopt;
+          }
+          return ChildTask{I, getWallTimeout(Pairs[I].Budget)};
+        },
+        [&](size_t I) {
+          Pair &P = Pairs[I];
+          if (P.Screen && ScreenInputs) {
+            ChildResult Screen = runInChild(
+                [&] {
+                  return screenRefinement(*P.Src, *P.Tgt, ScreenInputs) ==
+                                 ScreenResult::Mismatch
+                             ? ScreenedIncorrect
+                             : 0;
+                },
+                ScreenTimeoutSec);
+            if (Screen.Kind == ChildResult::Exited &&
+                Screen.Code == ScreenedIncorrect)
+              return ScreenedIncorrect;
+          }
+          smt::set_query_timeout(std::to_string(P.Budget));
+          return static_cast<int>(verifyFunction(*P.Src, *P.Tgt, TLI));
+        },
+        Jobs,
+        [&](size_t I, ChildResult Res) {
+          Pair &P = Pairs[I];
+          P.ElapsedMs += Res.ElapsedMs;
+          if (Res.Kind == ChildResult::Exited &&
+              Res.Code == ScreenedIncorrect) {
+            P.V = Verdict::Incorrect;
+            P.Screened = true;
+            return !StopOnIncorrect;
+          }
+          P.Screen = false;
+          if (Res.Kind == ChildResult::TimedOut) {
+            P.V = Verdict::Timeout;
+          } else if (Res.Kind == ChildResult::Exited &&
+                     Res.Code <= static_cast<int>(Verdict::Unsupported)) {
+            P.V = static_cast<Verdict>(Res.Code);
+          } else {
+            P.V = Verdict::Crash;
+            return true;
+          }
+          if (P.V == Verdict::Timeout && P.Budget < getMaxBudget()) {
+            P.Budget = static_cast<uint32_t>(
+                std::min<uint64_t>(uint64_t(P.Budget) * 10, getMaxBudget()));
+            Retries.push_back(I);
+            return true;
+          }
+          // A wall-clock kill depends on the load of the machine, so only the
+          // SMT timeouts Alive2 reports are cached.
+          if (P.V != Verdict::Timeout)
+            Cache.insert(P.Key, P.V);
+          else if (Res.Kind == ChildResult::Exited)
+            Cache.insert(VerdictCache::getTimeoutKey(P.Key, P.Budget), P.V);
+          Budgets.record(*P.Src, P.Budget, Res.ElapsedMs);
+          return !(StopOnIncorrect && P.V == Verdict::Incorrect);
+        });
+
+    Verdict Overall = Verdict::Correct;
+    json::Array Functions;
+    for (auto &P : Pairs) {
+      if (P.V != Verdict::Correct && P.V != Verdict::Skipped &&
+          (Overall == Verdict::Correct || P.V < Overall))
+        Overall = P.V;
+      json::Object Function{{"name", P.Src->getName()},
+                            {"verdict", getVerdictName(P.V)},
+                            {"identical", P.Identical},
+                            {"screened", P.Screened}};
+      if (P.Budget) {
+        Function["smt_to"] = P.Budget;
+        Function["time_ms"] = P.ElapsedMs;
+      }
+      Functions.push_back(std::move(Function));
+    }
+    return json::Object{{"verdict", getVerdictName(Overall)},
+                        {"functions", std::move(Functions)}};
+  }
+};
+} // namespace
+
+// Verifies tgt against src with Alive2 in process and prints a JSON verdict:
+//   {"verdict": "incorrect",
+//    "functions": [{"name": "f", "verdict": "incorrect", "identical": false,
+//                   "screened": true}]}
+// Functions verified by Alive2 also carry the last SMT timeout they were
+// verified with (smt_to) and the time all attempts took (time_ms).
+// Verdicts are correct, incorrect, crash (of Alive2), timeout, unsupported
+// (Alive2 could not encode or fully prove the function) and skipped (after
+// --stop-on-incorrect). identical is set when the pass left the function
+// unchanged, screened when a concrete input found it incorrect before Alive2.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "verify\n");
+
+  smt::set_query_timeout(std::to_string(SMTTimeout));
+  util::config::disable_undef_input = DisableUndefInput;
+  PairVerifier Verifier;
+
+  auto Answer = [&](StringRef Src, StringRef Tgt) {
+    auto Res = Verifier.verify(Src, Tgt);
+    if (!Res) {
+      outs() << "error " << toString(Res.takeError()) << '\n';
+      return false;
+    }
+    outs() << json::Value(std::move(*Res)) << '\n';
+    return true;
+  };
+
+  if (!Serve) {
+    if (SrcFile.empty() || TgtFile.empty()) {
+      errs() << "<src> and <tgt> are required\n";
+      return EXIT_FAILURE;
+    }
+    return Answer(SrcFile, TgtFile) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  for (std::string Line; std::getline(std::cin, Line);) {
+    auto [Src, Tgt] = StringRef(Line).trim().split(' ');
+    Tgt = Tgt.trim();
+    if (Src.empty())
+      continue;
+    if (Tgt.empty())
+      outs() << "error missing tgt\n";
+    else
+      Answer(Src, Tgt);
+    outs().flush();
+  }
+
+  return EXIT_SUCCESS;
+}